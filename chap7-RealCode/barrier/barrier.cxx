@@ -1,14 +1,35 @@
 #include <ctime>
 #include <pthread.h>
+#include <sched.h>
 
 #include "barrier.hxx"
 #include "errors.hxx"
+#include "spin.hxx"
 
 int barrier_init(barrier_t* barrier, int count)
+{
+    return barrier_init_mode(barrier, count, BARRIER_MUTEX);
+}
+
+int barrier_init_mode(barrier_t* barrier, int count, int mode)
 {
     int status;
 
+    if (mode != BARRIER_MUTEX && mode != BARRIER_SPIN) {
+        return EINVAL;
+    }
+
     barrier->threshold = barrier->counter = count; // 设置 通过 barrier 通过的 阈值
+    barrier->cycle = 0;
+    barrier->mode = mode;
+    barrier->sleepers = 0;
+    barrier->spins = 0;
+    barrier->reduce_state = 0;
+    barrier->completion = NULL;
+    barrier->completion_arg = NULL;
+#ifdef BARRIER_STATS
+    memset(&barrier->stats, 0, sizeof(barrier->stats));
+#endif
     status = pthread_mutex_init(&barrier->mutex, NULL);
     if (status != 0) {
         return status;
@@ -38,8 +59,10 @@ int barrier_destroy(barrier_t* barrier)
         return status1; /* 但是有个问题，就是没有解锁 */
     }
 
-    /* 看一下是不是有线程在等待 */
-    if (barrier->counter != barrier->threshold) {
+    /* 看一下是不是有线程在等待（BARRIER_SPIN 下 counter 不受 mutex 保护，要原子地读） */
+    int threshold = __atomic_load_n(&barrier->threshold, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&barrier->counter, __ATOMIC_ACQUIRE) != threshold
+        || __atomic_load_n(&barrier->sleepers, __ATOMIC_ACQUIRE) != 0) {
         pthread_mutex_unlock(&barrier->mutex);
         return EBUSY;
     }
@@ -57,6 +80,158 @@ int barrier_destroy(barrier_t* barrier)
     return (status1 != 0 ? status1 : status2);
 }
 
+/* reduce_state */
+#define REDUCE_EMPTY 0
+#define REDUCE_BUSY 1 // 第一个贡献者正在写入 reduce_value
+#define REDUCE_FULL 2
+
+/**
+ * @brief 最后一个到达的线程在放行之前调用：这时候这一轮的所有到达都已经发生了
+ *
+ */
+static void barrier_complete(barrier_t* barrier, unsigned int cycle)
+{
+    BARRIER_STATS_COMPLETE(barrier, cycle);
+
+    barrier->reduce_result = __atomic_load_n(&barrier->reduce_value, __ATOMIC_RELAXED);
+    __atomic_store_n(&barrier->reduce_state, REDUCE_EMPTY, __ATOMIC_RELAXED);
+
+    if (barrier->completion != NULL) {
+        barrier->completion(barrier->completion_arg);
+    }
+}
+
+/**
+ * sense-reversing：counter 原子地 --，减到 0 的线程把 counter 恢复，然后 cycle++（翻转 sense）。
+ * 其他线程记住自己到达时的 cycle，先自旋等 cycle 变化，自旋不到再 futex 睡在 cycle 上。
+ *
+ * 恢复 counter 一定要在 cycle++ 之前：看到新 cycle 的线程马上就可能进入下一轮。
+ */
+static int barrier_spin_arrive(barrier_t* barrier, unsigned int* token)
+{
+    unsigned int cycle = __atomic_load_n(&barrier->cycle, __ATOMIC_ACQUIRE);
+
+    *token = cycle;
+    BARRIER_STATS_ARRIVE(barrier, cycle);
+    if (__atomic_sub_fetch(&barrier->counter, 1, __ATOMIC_ACQ_REL) == 0) {
+        barrier_complete(barrier, cycle);
+        /* arrive_and_drop 改 threshold 发生在它的 -- 之前，上面的 ACQ_REL 保证这里能看到 */
+        int threshold = __atomic_load_n(&barrier->threshold, __ATOMIC_RELAXED);
+        __atomic_store_n(&barrier->counter, threshold, __ATOMIC_RELAXED); // 恢复
+        __atomic_store_n(&barrier->cycle, cycle + 1, __ATOMIC_SEQ_CST);
+
+        /* 和下面的 sleepers++ 配对：要么我们看到 sleepers，要么它的 futex_wait 看到新的 cycle */
+        if (__atomic_load_n(&barrier->sleepers, __ATOMIC_SEQ_CST) > 0) {
+            futex_wake(&barrier->cycle, INT_MAX);
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 自适应地转几圈，等 cycle 变化，等到了返回 1。
+ * 估计的是最近几轮 从到达到被放行 转了多少圈，到达得整齐的时候转几圈就够了，用不着睡
+ */
+static int barrier_spin(barrier_t* barrier, unsigned int cycle)
+{
+    int budget = spin_budget(&barrier->spins);
+
+    for (int spin = 0; spin < budget; spin++) {
+        if (__atomic_load_n(&barrier->cycle, __ATOMIC_ACQUIRE) != cycle) {
+            spin_update(&barrier->spins, spin);
+            return 1;
+        }
+        cpu_relax();
+    }
+
+    if (budget > 0) {
+        spin_update(&barrier->spins, budget);
+    }
+    return 0;
+}
+
+static int barrier_spin_await(barrier_t* barrier, unsigned int cycle)
+{
+    if (barrier_spin(barrier, cycle)) {
+        return 0;
+    }
+
+    __atomic_add_fetch(&barrier->sleepers, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&barrier->cycle, __ATOMIC_SEQ_CST) == cycle) {
+        futex_wait(&barrier->cycle, cycle); // EAGAIN、EINTR、虚假唤醒：都回去重新看 cycle
+    }
+    __atomic_sub_fetch(&barrier->sleepers, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief BARRIER_MUTEX 的到达，调用者持有 mutex
+ *
+ */
+static int barrier_mutex_arrive(barrier_t* barrier, unsigned int* token)
+{
+    int status;
+
+    *token = barrier->cycle;
+    BARRIER_STATS_ARRIVE(barrier, barrier->cycle);
+    if (--barrier->counter == 0) { // 这里有 --，我的评价是：代码风格很 鬼斧神工
+        barrier_complete(barrier, barrier->cycle);
+        __atomic_store_n(&barrier->cycle, barrier->cycle + 1, __ATOMIC_RELEASE);
+        barrier->counter = barrier->threshold; // 恢复
+
+        status = pthread_cond_broadcast(&barrier->cv);
+        if (status == 0) {
+            status = -1;
+        }
+        return status;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief BARRIER_MUTEX 的等待，调用者持有 mutex
+ *
+ */
+static int barrier_mutex_await(barrier_t* barrier, unsigned int cycle)
+{
+    int status = 0;
+    int cancel;
+
+    /* 关 中断（不能让他取消线程） */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
+
+    /* 先放开 mutex 转几圈（cycle 是原子地改的），多半不用去 cond 上睡。
+     * 转的时候算在 sleepers 里：我们还要回来拿 mutex，barrier_destroy 不能在这之前把它销毁 */
+    if (spin_limit() > 0 && cycle == barrier->cycle) {
+        __atomic_add_fetch(&barrier->sleepers, 1, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&barrier->mutex);
+        barrier_spin(barrier, cycle);
+        status = pthread_mutex_lock(&barrier->mutex);
+        __atomic_sub_fetch(&barrier->sleepers, 1, __ATOMIC_RELEASE);
+        if (status != 0) {
+            pthread_setcancelstate(cancel, NULL);
+            return status;
+        }
+    }
+
+    /* 当某一个线程 进入到了 barrier->counter == 0 的时候，cycle 会发生改变 */
+    /* 这个时候，不会继续等待。这种方式可以防止 虚假唤醒的现象发生 */
+    while (cycle == barrier->cycle) {
+        status = pthread_cond_wait(&barrier->cv, &barrier->mutex);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    pthread_setcancelstate(cancel, NULL);
+
+    return status;
+}
+
 /**
  * 我们这个设计的是：counter 一开始是：threshold，然后 --
  * 当 counter == 0 的时候，通知线程通过
@@ -66,50 +241,224 @@ int barrier_destroy(barrier_t* barrier)
 
 int barrier_wait(barrier_t* barrier)
 {
-    int status;
+    int status, status1;
+    unsigned int token;
 
     /* 检查是否有效 */
     if (barrier->valid != BARRIER_VALID) {
         return EINVAL;
     }
 
+    if (barrier->mode == BARRIER_SPIN) {
+        status = barrier_spin_arrive(barrier, &token);
+        if (status != 0) {
+            return status;
+        }
+        return barrier_spin_await(barrier, token);
+    }
+
     status = pthread_mutex_lock(&barrier->mutex);
     if (status != 0) {
         return status;
     }
     /* 上锁 */
 
-    unsigned long cycle = barrier->cycle;
+    status = barrier_mutex_arrive(barrier, &token);
+    if (status == 0) {
+        status = barrier_mutex_await(barrier, token);
+    }
 
-    int cancel;
+    /* 解锁，注意不要把上面的 -1 覆盖掉 */
+    status1 = pthread_mutex_unlock(&barrier->mutex);
+    if (status1 != 0) {
+        return status1;
+    }
 
-    if (--barrier->counter == 0) { // 这里有 --，我的评价是：代码风格很 鬼斧神工
-        barrier->cycle++;
-        barrier->counter = barrier->threshold; // 恢复
+    return status;
+}
 
-        status = pthread_cond_broadcast(&barrier->cv);
-        if (status == 0) {
-            status = -1;
-        }
-    } else {
-        /* 关 中断（不能让他取消线程） */
-        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel);
-
-        /* 当某一个线程 进入到了 barrier->counter == 0 的时候，cycle 会发生改变 */
-        /* 这个时候，不会继续等待。这种方式可以防止 虚假唤醒的现象发生 */
-        while (cycle == barrier->cycle) {
-            status = pthread_cond_wait(&barrier->cv, &barrier->mutex);
-            if (status != 0) {
-                break;
-            }
+/**
+ * split-phase 的前一半：只到达，不等待。
+ *
+ * token 记下这一轮的 cycle，之后交给 barrier_wait_token。
+ * 返回值和 barrier_wait 一样：最后一个到达的线程（完成了这一轮）返回 -1
+ */
+int barrier_arrive(barrier_t* barrier, unsigned int* token)
+{
+    int status, status1;
+
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    if (barrier->mode == BARRIER_SPIN) {
+        return barrier_spin_arrive(barrier, token);
+    }
+
+    status = pthread_mutex_lock(&barrier->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    status = barrier_mutex_arrive(barrier, token);
+
+    status1 = pthread_mutex_unlock(&barrier->mutex);
+    if (status1 != 0) {
+        return status1;
+    }
+
+    return status;
+}
+
+/**
+ * split-phase 的后一半：token 那一轮如果已经完成，立即返回；否则等它完成
+ */
+int barrier_wait_token(barrier_t* barrier, unsigned int token)
+{
+    int status, status1;
+
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    /* 快速路径：cycle 已经变了，说明那一轮完成了，不用碰 mutex */
+    if (__atomic_load_n(&barrier->cycle, __ATOMIC_ACQUIRE) != token) {
+        return 0;
+    }
+
+    if (barrier->mode == BARRIER_SPIN) {
+        return barrier_spin_await(barrier, token);
+    }
+
+    status = pthread_mutex_lock(&barrier->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    status = barrier_mutex_await(barrier, token);
+
+    status1 = pthread_mutex_unlock(&barrier->mutex);
+    if (status1 != 0) {
+        return status1;
+    }
+
+    return status;
+}
+
+long barrier_op_sum(long a, long b)
+{
+    return a + b;
+}
+
+long barrier_op_min(long a, long b)
+{
+    return a < b ? a : b;
+}
+
+long barrier_op_max(long a, long b)
+{
+    return a > b ? a : b;
+}
+
+/**
+ * @brief 把 value 合并进这一轮的 reduce_value，一定要在 arrive 之前做：
+ * 这样最后一个到达的线程（arrive 里的 -- 同步了所有人）能看到所有的贡献
+ *
+ * 第一个贡献者直接写入，避免要求 op 提供单位元；其他人用 CAS 合并
+ */
+static void barrier_combine(barrier_t* barrier, long value, barrier_op_t op)
+{
+    int state = REDUCE_EMPTY;
+
+    if (__atomic_compare_exchange_n(&barrier->reduce_state, &state, REDUCE_BUSY,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&barrier->reduce_value, value, __ATOMIC_RELAXED);
+        __atomic_store_n(&barrier->reduce_state, REDUCE_FULL, __ATOMIC_RELEASE);
+        return;
+    }
+
+    /* 第一个贡献者只差一次 store，一般转几圈就好了；万一它被换下去了，就让出 cpu */
+    for (int spin = 0; state != REDUCE_FULL; spin++) {
+        if (spin < spin_limit()) {
+            cpu_relax();
+        } else {
+            sched_yield();
         }
+        state = __atomic_load_n(&barrier->reduce_state, __ATOMIC_ACQUIRE);
+    }
+
+    long old = __atomic_load_n(&barrier->reduce_value, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&barrier->reduce_value, &old, op(old, value),
+        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * 合并发生在到达的过程中：没有 领头线程 的串行汇总，也不需要再来一次 barrier
+ */
+int barrier_wait_reduce(barrier_t* barrier, long value, barrier_op_t op, long* result)
+{
+    int status;
+
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    barrier_combine(barrier, value, op);
+
+    status = barrier_wait(barrier);
+    if (status > 0) {
+        return status;
+    }
+
+    /* 下一轮的 barrier_complete 要等我们再次到达才会发生，所以这里读到的一定是这一轮的结果 */
+    *result = barrier->reduce_result;
+
+    return status;
+}
+
+int barrier_arrive_and_drop(barrier_t* barrier)
+{
+    int status, status1;
+    unsigned int token;
+
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    if (barrier->mode == BARRIER_SPIN) {
+        __atomic_sub_fetch(&barrier->threshold, 1, __ATOMIC_RELAXED);
+        return barrier_spin_arrive(barrier, &token);
     }
 
-    /* 解锁 */
-    status = pthread_mutex_unlock(&barrier->mutex);
+    status = pthread_mutex_lock(&barrier->mutex);
     if (status != 0) {
         return status;
     }
 
+    barrier->threshold--; // 先减：如果我们是最后一个到达的，恢复 counter 时就已经是新的 threshold 了
+    status = barrier_mutex_arrive(barrier, &token);
+
+    status1 = pthread_mutex_unlock(&barrier->mutex);
+    if (status1 != 0) {
+        return status1;
+    }
+
     return status;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief 要在参与者开始使用 barrier 之前设置
+ *
+ */
+int barrier_setcompletion(barrier_t* barrier, void (*completion)(void*), void* arg)
+{
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    barrier->completion = completion;
+    barrier->completion_arg = arg;
+
+    return 0;
+}
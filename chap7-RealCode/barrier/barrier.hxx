@@ -1,17 +1,75 @@
+#include <cstdio>
 #include <pthread.h>
 
 #ifndef __BARRIER_HXX__
 #define __BARRIER_HXX__
 
+/**
+ * barrier 的两种实现
+ *
+ * BARRIER_MUTEX : 默认。counter 由 mutex 保护，在 cv 上睡眠
+ * BARRIER_SPIN  : counter 原子递减，cycle 当作 sense（代数）翻转；
+ *                 等待者先自旋一小会儿，然后再在 cycle 上 futex 睡眠
+ */
+#define BARRIER_MUTEX 0
+#define BARRIER_SPIN 1
+
+/**
+ * 掉队线程统计：编译时 -DBARRIER_STATS 打开，不打开的时候 barrier_t 里没有这些字段，
+ * 钩子也都展开成空语句。
+ *
+ * 每个参与的线程占一个 slot，记下它每一轮相对于这一轮第一个到达者晚了多少（skew），
+ * 按 log2(ns) 做直方图；另外按 cycle 保留最近几轮的记录：谁最后到，晚了多少
+ */
+#define BARRIER_STATS_SLOTS 64
+#define BARRIER_STATS_BUCKETS 32 // hist[i]：skew 在 [2^(i-1), 2^i) ns，hist[0] 是 0
+#define BARRIER_STATS_HISTORY 16
+
+typedef struct barrier_slot_tag {
+    alignas(64) pthread_t thread;
+    int used;
+    unsigned int cycle; // 最近一次到达的 cycle
+    long arrive; // 最近一次到达的时间，ns
+    long skew; // 最近一轮的 skew
+    long max_skew;
+    unsigned long count; // 统计了多少轮
+    unsigned long hist[BARRIER_STATS_BUCKETS];
+} barrier_slot_t;
+
+typedef struct barrier_cycle_stat_tag {
+    unsigned int cycle;
+    int straggler; // 最后到达的 slot
+    long spread; // 最后一个 - 第一个，ns
+} barrier_cycle_stat_t;
+
+typedef struct barrier_stats_tag {
+    barrier_slot_t slots[BARRIER_STATS_SLOTS];
+    barrier_cycle_stat_t history[BARRIER_STATS_HISTORY]; // 下标是 cycle % BARRIER_STATS_HISTORY
+} barrier_stats_t;
+
 typedef struct barrier_tag {
     pthread_mutex_t mutex; // 用来保护 counter
     pthread_cond_t cv;
     int valid; // 设置有效，实际上这个设置为 1 就好了，但是我们可以乱设置一个数字
     int threshold; // 需要多少个线程
     int counter; // current number of threads
-    unsigned long cycle; // count cycles
+    unsigned int cycle; // count cycles，BARRIER_SPIN 下同时是 futex word
+    int mode; // BARRIER_MUTEX / BARRIER_SPIN
+    int sleepers; // BARRIER_SPIN：睡在 futex 上的线程数，没人睡的时候就不用 futex_wake 了；BARRIER_MUTEX：放开 mutex 在自旋的线程数
+    int spins; // 等到放行之前自旋的圈数估计，见 spin_update
+    int reduce_state; // barrier_wait_reduce：这一轮的 reduce_value 是否已经有值
+    long reduce_value; // 这一轮到目前为止的合并结果
+    long reduce_result; // 上一轮的最终结果，最后一个到达的线程写入
+    void (*completion)(void* arg); // 每一轮，最后一个到达的线程在放行之前调用一次
+    void* completion_arg;
+#ifdef BARRIER_STATS
+    barrier_stats_t stats;
+#endif
 } barrier_t;
 
+/* barrier_wait_reduce 的合并函数，要满足结合律、交换律（到达的顺序是不确定的） */
+typedef long (*barrier_op_t)(long, long);
+
 #define BARRIER_VALID 0xdbcafe /* 没懂这个 数字是用来干啥的，保存到 valid 中，我的评价是 6 */
 
 #define BARRIER_INITIALIZER(cnt)      \
@@ -24,11 +82,75 @@ typedef struct barrier_tag {
             0                         \
     }
 
+#define BARRIER_SPIN_INITIALIZER(cnt) \
+    {                                 \
+        PTHREAD_MUTEX_INITIALIZER,    \
+            PTHREAD_COND_INITIALIZER, \
+            BARRIER_VALID,            \
+            cnt,                      \
+            cnt,                      \
+            0,                        \
+            BARRIER_SPIN,             \
+            0                         \
+    }
+
 /**
  * define barrcntions
  */
 extern int barrier_init(barrier_t* barrier, int count);
+extern int barrier_init_mode(barrier_t* barrier, int count, int mode);
 extern int barrier_destroy(barrier_t* barrier);
 extern int barrier_wait(barrier_t* barrier);
 
-#endif //  __BARRIER_HXX__
\ No newline at end of file
+/**
+ * split-phase：barrier_wait == barrier_arrive + barrier_wait_token
+ * 两者之间可以做和这一轮无关的本地工作；同一个线程不能在 wait_token 之前再次 arrive
+ */
+extern int barrier_arrive(barrier_t* barrier, unsigned int* token);
+extern int barrier_wait_token(barrier_t* barrier, unsigned int token);
+
+/**
+ * 到达的时候把 value 合并进这一轮的结果，放行之后每个线程从 result 拿到全体的合并结果。
+ * 这一轮所有的参与者都要调用 barrier_wait_reduce（并且用同一个 op）
+ */
+extern int barrier_wait_reduce(barrier_t* barrier, long value, barrier_op_t op, long* result);
+extern long barrier_op_sum(long a, long b);
+extern long barrier_op_min(long a, long b);
+extern long barrier_op_max(long a, long b);
+
+/**
+ * 动态成员：
+ * barrier_arrive_and_drop 算作这一轮的一次到达（不等待），并且从下一轮开始 threshold - 1。
+ * 返回值和 barrier_arrive 一样，调用之后这个线程就不再是参与者了
+ *
+ * completion 在最后一个到达的线程上、所有人被放行之前执行，每轮恰好一次（类似 std::barrier）。
+ * BARRIER_MUTEX 下它在持有 mutex 的时候执行，所以 completion 里不能再使用这个 barrier
+ */
+extern int barrier_arrive_and_drop(barrier_t* barrier);
+extern int barrier_setcompletion(barrier_t* barrier, void (*completion)(void*), void* arg);
+
+/**
+ * 运行时查询。没有 -DBARRIER_STATS 的时候返回 ENOSYS
+ * slot 的编号就是线程第一次到达时分到的编号；读的时候 barrier 可以还在用（数字可能差一轮）
+ */
+extern int barrier_stats_slot(barrier_t* barrier, int slot, barrier_slot_t* out);
+extern int barrier_stats_cycle(barrier_t* barrier, unsigned int cycle, barrier_cycle_stat_t* out);
+extern int barrier_stats_dump(barrier_t* barrier, FILE* out);
+
+#ifdef BARRIER_STATS
+extern void barrier_stats_arrive(barrier_t* barrier, unsigned int cycle);
+extern void barrier_stats_complete(barrier_t* barrier, unsigned int cycle);
+#define BARRIER_STATS_ARRIVE(barrier, cycle) barrier_stats_arrive(barrier, cycle)
+#define BARRIER_STATS_COMPLETE(barrier, cycle) barrier_stats_complete(barrier, cycle)
+#else
+#define BARRIER_STATS_ARRIVE(barrier, cycle) \
+    do {                                     \
+        (void)(cycle);                       \
+    } while (0)
+#define BARRIER_STATS_COMPLETE(barrier, cycle) \
+    do {                                       \
+        (void)(cycle);                         \
+    } while (0)
+#endif
+
+#endif //  __BARRIER_HXX__
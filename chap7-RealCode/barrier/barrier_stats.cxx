@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <ctime>
+#include <pthread.h>
+
+#include "barrier.hxx"
+#include "errors.hxx"
+
+#ifdef BARRIER_STATS
+
+/* 线程上一次用的 barrier 和 slot，绝大多数线程只用一个 barrier，这样就不用每次都去找 */
+static thread_local barrier_t* cached_barrier;
+static thread_local int cached_slot;
+
+static long stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/**
+ * @brief 找到（或者占一个）当前线程的 slot，满了返回 -1（这个线程就不统计了）
+ *
+ */
+static int stats_slot(barrier_t* barrier)
+{
+    barrier_stats_t* stats = &barrier->stats;
+    pthread_t self = pthread_self();
+
+    /* barrier 可能被 destroy 之后在同一个地址重新 init，所以还要确认 slot 确实是我们的 */
+    if (cached_barrier == barrier) {
+        barrier_slot_t* slot = &stats->slots[cached_slot];
+        if (__atomic_load_n(&slot->used, __ATOMIC_ACQUIRE) == 2 && pthread_equal(slot->thread, self)) {
+            return cached_slot;
+        }
+    }
+
+    for (int i = 0; i < BARRIER_STATS_SLOTS; i++) {
+        barrier_slot_t* slot = &stats->slots[i];
+        int used = __atomic_load_n(&slot->used, __ATOMIC_ACQUIRE);
+
+        if (used == 2 && pthread_equal(slot->thread, self)) {
+            cached_barrier = barrier;
+            cached_slot = i;
+            return i;
+        }
+
+        /* 0：空闲，1：正在被占，2：已经占好了 */
+        if (used == 0 && __atomic_compare_exchange_n(&slot->used, &used, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            slot->thread = self;
+            __atomic_store_n(&slot->used, 2, __ATOMIC_RELEASE);
+            cached_barrier = barrier;
+            cached_slot = i;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/**
+ * @brief 到达的时候（-- 之前）记下时间，-- 把它发布给最后一个到达的线程
+ *
+ */
+void barrier_stats_arrive(barrier_t* barrier, unsigned int cycle)
+{
+    int i = stats_slot(barrier);
+    if (i < 0) {
+        return;
+    }
+
+    barrier_slot_t* slot = &barrier->stats.slots[i];
+    __atomic_store_n(&slot->arrive, stats_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->cycle, cycle, __ATOMIC_RELAXED);
+}
+
+static int stats_bucket(long ns)
+{
+    int bucket = 0;
+    while (ns > 0 && bucket < BARRIER_STATS_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * @brief 最后一个到达的线程在放行之前调用：这一轮所有人的到达时间都已经写好了，
+ * 而且在它放行之前没有人会再写，所以这里不需要任何同步
+ */
+void barrier_stats_complete(barrier_t* barrier, unsigned int cycle)
+{
+    barrier_stats_t* stats = &barrier->stats;
+    long first = 0, last = 0;
+    int straggler = -1;
+
+    for (int i = 0; i < BARRIER_STATS_SLOTS; i++) {
+        barrier_slot_t* slot = &stats->slots[i];
+        if (__atomic_load_n(&slot->used, __ATOMIC_ACQUIRE) != 2 || slot->cycle != cycle) {
+            continue;
+        }
+        if (straggler < 0 || slot->arrive < first) {
+            first = slot->arrive;
+        }
+        if (straggler < 0 || slot->arrive >= last) {
+            last = slot->arrive;
+            straggler = i;
+        }
+    }
+
+    if (straggler < 0) {
+        return;
+    }
+
+    for (int i = 0; i < BARRIER_STATS_SLOTS; i++) {
+        barrier_slot_t* slot = &stats->slots[i];
+        if (__atomic_load_n(&slot->used, __ATOMIC_ACQUIRE) != 2 || slot->cycle != cycle) {
+            continue;
+        }
+        long skew = slot->arrive - first;
+        __atomic_store_n(&slot->skew, skew, __ATOMIC_RELAXED);
+        if (skew > slot->max_skew) {
+            __atomic_store_n(&slot->max_skew, skew, __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&slot->count, slot->count + 1, __ATOMIC_RELAXED);
+        int bucket = stats_bucket(skew);
+        __atomic_store_n(&slot->hist[bucket], slot->hist[bucket] + 1, __ATOMIC_RELAXED);
+    }
+
+    barrier_cycle_stat_t* record = &stats->history[cycle % BARRIER_STATS_HISTORY];
+    __atomic_store_n(&record->straggler, straggler, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->spread, last - first, __ATOMIC_RELAXED);
+    __atomic_store_n(&record->cycle, cycle, __ATOMIC_RELEASE);
+}
+
+int barrier_stats_slot(barrier_t* barrier, int slot, barrier_slot_t* out)
+{
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+    if (slot < 0 || slot >= BARRIER_STATS_SLOTS) {
+        return EINVAL;
+    }
+
+    barrier_slot_t* src = &barrier->stats.slots[slot];
+    if (__atomic_load_n(&src->used, __ATOMIC_ACQUIRE) != 2) {
+        return ENOENT;
+    }
+
+    out->thread = src->thread;
+    out->used = 2;
+    out->cycle = __atomic_load_n(&src->cycle, __ATOMIC_RELAXED);
+    out->arrive = __atomic_load_n(&src->arrive, __ATOMIC_RELAXED);
+    out->skew = __atomic_load_n(&src->skew, __ATOMIC_RELAXED);
+    out->max_skew = __atomic_load_n(&src->max_skew, __ATOMIC_RELAXED);
+    out->count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+    for (int i = 0; i < BARRIER_STATS_BUCKETS; i++) {
+        out->hist[i] = __atomic_load_n(&src->hist[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 只保留最近 BARRIER_STATS_HISTORY 轮，太旧（或者还没完成）的 cycle 返回 ENOENT
+ *
+ */
+int barrier_stats_cycle(barrier_t* barrier, unsigned int cycle, barrier_cycle_stat_t* out)
+{
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    barrier_cycle_stat_t* record = &barrier->stats.history[cycle % BARRIER_STATS_HISTORY];
+    if (__atomic_load_n(&record->cycle, __ATOMIC_ACQUIRE) != cycle) {
+        return ENOENT;
+    }
+
+    out->cycle = cycle;
+    out->straggler = __atomic_load_n(&record->straggler, __ATOMIC_RELAXED);
+    out->spread = __atomic_load_n(&record->spread, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&record->cycle, __ATOMIC_ACQUIRE) != cycle) {
+        return ENOENT; // 读的时候被新的一轮覆盖了
+    }
+
+    return 0;
+}
+
+int barrier_stats_dump(barrier_t* barrier, FILE* out)
+{
+    barrier_slot_t slot;
+
+    if (barrier->valid != BARRIER_VALID) {
+        return EINVAL;
+    }
+
+    fprintf(out, "slot  cycles   last skew    max skew  skew histogram (log2 ns: count)\n");
+    for (int i = 0; i < BARRIER_STATS_SLOTS; i++) {
+        if (barrier_stats_slot(barrier, i, &slot) != 0) {
+            continue;
+        }
+        fprintf(out, "%4d %7lu %11ld %11ld ", i, slot.count, slot.skew, slot.max_skew);
+        for (int bucket = 0; bucket < BARRIER_STATS_BUCKETS; bucket++) {
+            if (slot.hist[bucket] != 0) {
+                fprintf(out, " %d:%lu", bucket, slot.hist[bucket]);
+            }
+        }
+        fprintf(out, "\n");
+    }
+
+    return 0;
+}
+
+#else
+
+int barrier_stats_slot(barrier_t* barrier, int slot, barrier_slot_t* out)
+{
+    return ENOSYS;
+}
+
+int barrier_stats_cycle(barrier_t* barrier, unsigned int cycle, barrier_cycle_stat_t* out)
+{
+    return ENOSYS;
+}
+
+int barrier_stats_dump(barrier_t* barrier, FILE* out)
+{
+    return ENOSYS;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include <barrier>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "barrier.hxx"
+#include "errors.hxx"
+#include "tbarrier.hxx"
+
+/**
+ * barrier 延迟测试
+ *
+ * 每个线程在每一轮记下 到达时间 和 离开时间，然后对每一轮算：
+ *   latency = 最后一个线程离开 - 最后一个线程到达   （barrier 本身的开销：所有人都到了，还要多久才全部放行）
+ *   skew    = 最后一个线程到达 - 第一个线程到达     （到达的参差，和 barrier 无关，但是会被算进等待时间里）
+ * episodes/s 只算正式的这些轮：先跑 WARMUP 轮，再一起过一次 barrier 作为起点，到最后一个线程离开最后一轮为止，
+ * 不包括创建线程和热身
+ *
+ * usage: brr_bench [max_threads] [episodes]
+ */
+
+#define WARMUP 100
+
+typedef struct bench_tag {
+    const char* name;
+    int (*init)(struct bench_tag* bench, int threads);
+    void (*wait)(struct bench_tag* bench, int self);
+    void (*destroy)(struct bench_tag* bench);
+    barrier_t barrier;
+    tbarrier_t tbarrier;
+    pthread_barrier_t pbarrier;
+    std::barrier<>* sbarrier;
+} bench_t;
+
+typedef struct worker_tag {
+    alignas(64) pthread_t thread_id;
+    int number;
+    bench_t* bench;
+    int episodes;
+    long start; // 热身之后过起点 barrier 的时间，ns
+    long* arrive; // 每一轮的时间戳，ns
+    long* depart;
+} worker_t;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int mutex_init(bench_t* bench, int threads)
+{
+    return barrier_init_mode(&bench->barrier, threads, BARRIER_MUTEX);
+}
+
+static int spin_init(bench_t* bench, int threads)
+{
+    return barrier_init_mode(&bench->barrier, threads, BARRIER_SPIN);
+}
+
+static void barrier_t_wait(bench_t* bench, int self)
+{
+    int status = barrier_wait(&bench->barrier);
+    if (status > 0) {
+        err_abort(status, "wait on barrier");
+    }
+}
+
+static void barrier_t_destroy(bench_t* bench)
+{
+    barrier_destroy(&bench->barrier);
+}
+
+static int tree_init(bench_t* bench, int threads)
+{
+    return tbarrier_init(&bench->tbarrier, threads);
+}
+
+static void tree_wait(bench_t* bench, int self)
+{
+    int status = tbarrier_wait(&bench->tbarrier, self);
+    if (status > 0) {
+        err_abort(status, "wait on tbarrier");
+    }
+}
+
+static void tree_destroy(bench_t* bench)
+{
+    tbarrier_destroy(&bench->tbarrier);
+}
+
+static int pthread_init(bench_t* bench, int threads)
+{
+    return pthread_barrier_init(&bench->pbarrier, NULL, threads);
+}
+
+static void pthread_wait(bench_t* bench, int self)
+{
+    int status = pthread_barrier_wait(&bench->pbarrier);
+    if (status != 0 && status != PTHREAD_BARRIER_SERIAL_THREAD) {
+        err_abort(status, "wait on pthread barrier");
+    }
+}
+
+static void pthread_destroy(bench_t* bench)
+{
+    pthread_barrier_destroy(&bench->pbarrier);
+}
+
+static int std_init(bench_t* bench, int threads)
+{
+    bench->sbarrier = new std::barrier<>(threads);
+    return 0;
+}
+
+static void std_wait(bench_t* bench, int self)
+{
+    bench->sbarrier->arrive_and_wait();
+}
+
+static void std_destroy(bench_t* bench)
+{
+    delete bench->sbarrier;
+}
+
+static bench_t benches[] = {
+    { "barrier_t(mutex)", mutex_init, barrier_t_wait, barrier_t_destroy },
+    { "barrier_t(spin)", spin_init, barrier_t_wait, barrier_t_destroy },
+    { "tbarrier_t", tree_init, tree_wait, tree_destroy },
+    { "pthread_barrier_t", pthread_init, pthread_wait, pthread_destroy },
+    { "std::barrier", std_init, std_wait, std_destroy },
+};
+
+static void* worker_routine(void* arg)
+{
+    worker_t* self = (worker_t*)arg;
+    bench_t* bench = self->bench;
+
+    for (int i = 0; i < WARMUP; i++) {
+        bench->wait(bench, self->number);
+    }
+    bench->wait(bench, self->number);
+    self->start = now_ns();
+
+    for (int episode = 0; episode < self->episodes; episode++) {
+        self->arrive[episode] = now_ns();
+        bench->wait(bench, self->number);
+        self->depart[episode] = now_ns();
+    }
+
+    return NULL;
+}
+
+static long percentile(std::vector<long>& v, double p)
+{
+    size_t index = (size_t)(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + index, v.end());
+    return v[index];
+}
+
+static void run(bench_t* bench, int threads, int episodes)
+{
+    int status;
+    std::vector<worker_t> workers(threads);
+
+    status = bench->init(bench, threads);
+    HANDLE_STATUS("init barrier");
+
+    for (int i = 0; i < threads; i++) {
+        workers[i].number = i;
+        workers[i].bench = bench;
+        workers[i].episodes = episodes;
+        workers[i].arrive = (long*)malloc(episodes * sizeof(long));
+        workers[i].depart = (long*)malloc(episodes * sizeof(long));
+        if (workers[i].arrive == NULL || workers[i].depart == NULL) {
+            errno_abort("allocate timestamps");
+        }
+    }
+
+    for (int i = 0; i < threads; i++) {
+        status = pthread_create(&workers[i].thread_id, NULL, worker_routine, &workers[i]);
+        HANDLE_STATUS("create thread");
+    }
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(workers[i].thread_id, NULL);
+        HANDLE_STATUS("join thread");
+    }
+
+    long start = workers[0].start;
+    long end = workers[0].depart[episodes - 1];
+    for (int i = 1; i < threads; i++) {
+        start = std::min(start, workers[i].start);
+        end = std::max(end, workers[i].depart[episodes - 1]);
+    }
+    long elapsed = end - start;
+
+    std::vector<long> latency(episodes), skew(episodes);
+    for (int episode = 0; episode < episodes; episode++) {
+        long first_arrive = workers[0].arrive[episode];
+        long last_arrive = first_arrive;
+        long last_depart = workers[0].depart[episode];
+        for (int i = 1; i < threads; i++) {
+            first_arrive = std::min(first_arrive, workers[i].arrive[episode]);
+            last_arrive = std::max(last_arrive, workers[i].arrive[episode]);
+            last_depart = std::max(last_depart, workers[i].depart[episode]);
+        }
+        latency[episode] = last_depart - last_arrive;
+        skew[episode] = last_arrive - first_arrive;
+    }
+
+    long latency_max = *std::max_element(latency.begin(), latency.end());
+    long skew_max = *std::max_element(skew.begin(), skew.end());
+    printf("%-18s %3d %12.0f %9ld %9ld %10ld %9ld %9ld %10ld\n",
+        bench->name, threads, episodes / (elapsed / 1e9),
+        percentile(latency, 0.50), percentile(latency, 0.99), latency_max,
+        percentile(skew, 0.50), percentile(skew, 0.99), skew_max);
+
+    for (int i = 0; i < threads; i++) {
+        free(workers[i].arrive);
+        free(workers[i].depart);
+    }
+    bench->destroy(bench);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int episodes = 10000;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        episodes = atoi(argv[2]);
+    }
+    if (max_threads <= 0 || episodes <= 0) {
+        fprintf(stderr, "usage: %s [max_threads] [episodes]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%-18s %3s %12s %9s %9s %10s %9s %9s %10s\n",
+        "barrier", "thr", "episodes/s", "lat p50", "lat p99", "lat max",
+        "skew p50", "skew p99", "skew max");
+    printf("(latency/skew in ns)\n");
+
+    for (auto& bench : benches) {
+        for (int threads = 1; threads <= max_threads; threads++) {
+            run(&bench, threads, episodes);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,214 @@
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+#include "barrier.hxx"
+#include "bsp.hxx"
+#include "errors.hxx"
+
+/**
+ * @brief barrier 的 completion：这个 phase 所有人都到了，还没有人被放行
+ *
+ */
+static void bsp_complete(void* arg)
+{
+    bsp_t* bsp = (bsp_t*)arg;
+
+    if (bsp->leader != NULL) {
+        bsp->leader(bsp, bsp->phase);
+    }
+    bsp->phase++;
+}
+
+int bsp_init(bsp_t* bsp, int threads, size_t state_size,
+    bsp_kernel_t kernel, bsp_leader_t leader, void* arg)
+{
+    int status;
+
+    if (threads <= 0 || kernel == NULL) {
+        return EINVAL;
+    }
+
+    bsp->stride = (state_size + BSP_CACHE_LINE - 1) / BSP_CACHE_LINE * BSP_CACHE_LINE;
+    if (bsp->stride == 0) {
+        bsp->stride = BSP_CACHE_LINE;
+    }
+
+    bsp->states = (char*)aligned_alloc(BSP_CACHE_LINE, threads * bsp->stride);
+    if (bsp->states == NULL) {
+        return ENOMEM;
+    }
+    memset(bsp->states, 0, threads * bsp->stride);
+
+    bsp->workers = (bsp_worker_t*)calloc(threads, sizeof(bsp_worker_t));
+    if (bsp->workers == NULL) {
+        free(bsp->states);
+        return ENOMEM;
+    }
+
+    /* phase 很短的时候，先自旋的 barrier 比 mutex + cond 划算得多 */
+    status = barrier_init_mode(&bsp->barrier, threads, BARRIER_SPIN);
+    if (status != 0) {
+        free(bsp->workers);
+        free(bsp->states);
+        return status;
+    }
+    barrier_setcompletion(&bsp->barrier, bsp_complete, bsp);
+
+    bsp->threads = threads;
+    bsp->phases = 0;
+    bsp->phase = 0;
+    bsp->kernel = kernel;
+    bsp->leader = leader;
+    bsp->arg = arg;
+    bsp->valid = BSP_VALID;
+
+    return 0;
+}
+
+int bsp_destroy(bsp_t* bsp)
+{
+    int status;
+
+    if (bsp->valid != BSP_VALID) {
+        return EINVAL;
+    }
+
+    status = barrier_destroy(&bsp->barrier);
+    if (status != 0) {
+        return status;
+    }
+
+    bsp->valid = 0;
+    free(bsp->workers);
+    free(bsp->states);
+
+    return 0;
+}
+
+void* bsp_state(bsp_t* bsp, int self)
+{
+    if (bsp->valid != BSP_VALID || self < 0 || self >= bsp->threads) {
+        return NULL;
+    }
+    return bsp->states + self * bsp->stride;
+}
+
+static void* bsp_routine(void* arg)
+{
+    int status;
+    bsp_worker_t* self = (bsp_worker_t*)arg;
+    bsp_t* bsp = self->bsp;
+    void* state = bsp_state(bsp, self->number);
+
+    for (int phase = 0; phase < bsp->phases; phase++) {
+        bsp->kernel(bsp, self->number, phase, state);
+
+        status = barrier_wait(&bsp->barrier);
+        if (status > 0) {
+            err_abort(status, "wait on barrier");
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief 第 i 个线程绑到进程允许的第 (i % n) 个 cpu 上
+ *
+ */
+static int bsp_pick_cpu(cpu_set_t* allowed, int number)
+{
+    int n = CPU_COUNT(allowed);
+    if (n == 0) {
+        return -1;
+    }
+
+    int k = number % n;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, allowed) && k-- == 0) {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+int bsp_run(bsp_t* bsp, int phases)
+{
+    int status, created;
+    pthread_attr_t attr;
+    cpu_set_t allowed, cpus;
+
+    if (bsp->valid != BSP_VALID || phases < 0) {
+        return EINVAL;
+    }
+
+    bsp->phases = phases;
+    bsp->phase = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        CPU_ZERO(&allowed);
+    }
+
+    status = pthread_attr_init(&attr);
+    if (status != 0) {
+        return status;
+    }
+
+    for (created = 0; created < bsp->threads; created++) {
+        bsp_worker_t* worker = &bsp->workers[created];
+        worker->number = created;
+        worker->bsp = bsp;
+        worker->cpu = bsp_pick_cpu(&allowed, created);
+
+        /* 在创建的时候就绑好，线程从第一条指令开始就在自己的 cpu 上 */
+        if (worker->cpu >= 0) {
+            CPU_ZERO(&cpus);
+            CPU_SET(worker->cpu, &cpus);
+            status = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+            if (status != 0) {
+                break;
+            }
+        }
+
+        status = pthread_create(&worker->thread_id, &attr, bsp_routine, worker);
+        if (status != 0) {
+            break;
+        }
+    }
+
+    pthread_attr_destroy(&attr);
+
+    if (status != 0 && created > 0 && phases > 0) {
+        /* 没创建出来的线程算作在第一个 phase 的 barrier 上到达并退出，已经创建的线程才能把 phases 跑完 */
+        for (int i = created; i < bsp->threads; i++) {
+            int status1 = barrier_arrive_and_drop(&bsp->barrier);
+            if (status1 > 0) {
+                err_abort(status1, "drop bsp thread"); // 已经创建的线程会永远等在 barrier 上
+            }
+        }
+    }
+
+    for (int i = 0; i < created; i++) {
+        int status1 = pthread_join(bsp->workers[i].thread_id, NULL);
+        if (status1 != 0) {
+            return status1;
+        }
+    }
+
+    if (status != 0 && created > 0 && phases > 0) {
+        /* 把 threshold 恢复成 threads，下次 bsp_run 还能用 */
+        int status1 = barrier_destroy(&bsp->barrier);
+        if (status1 == 0) {
+            status1 = barrier_init_mode(&bsp->barrier, bsp->threads, BARRIER_SPIN);
+        }
+        if (status1 != 0) {
+            bsp->valid = 0;
+            return status1;
+        }
+        barrier_setcompletion(&bsp->barrier, bsp_complete, bsp);
+    }
+
+    return status;
+}
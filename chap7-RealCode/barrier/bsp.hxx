@@ -0,0 +1,63 @@
+#include <cstddef>
+#include <pthread.h>
+
+#include "barrier.hxx"
+
+#ifndef __BSP_HXX__
+#define __BSP_HXX__
+
+/**
+ * BSP（bulk synchronous parallel）执行器：
+ *
+ * 每个 phase：所有线程各自跑 kernel，然后在 barrier 上会合；
+ * 最后一个到达的线程在放行之前跑一次 leader（barrier 的 completion），所以 leader 看到的是
+ * 这个 phase 所有线程的结果，而且 leader 跑的时候没有人在算，不需要再来一次 barrier。
+ *
+ * 每个线程的状态占 state_size 字节，按 cache line 对齐、互不共享 cache line；
+ * 线程在 bsp_run 期间一直绑在同一个 cpu 上
+ */
+
+#define BSP_CACHE_LINE 64
+
+typedef struct bsp_tag bsp_t;
+
+typedef void (*bsp_kernel_t)(bsp_t* bsp, int self, int phase, void* state);
+typedef void (*bsp_leader_t)(bsp_t* bsp, int phase);
+
+typedef struct bsp_worker_tag {
+    pthread_t thread_id;
+    int number;
+    int cpu; // 绑在哪个 cpu 上，-1 表示没有绑
+    bsp_t* bsp;
+} bsp_worker_t;
+
+struct bsp_tag {
+    barrier_t barrier;
+    int valid;
+    int threads;
+    int phases; // bsp_run 要跑多少个 phase
+    int phase; // leader 正在收尾的 phase
+    size_t stride; // state_size 向上取整到 cache line
+    char* states; // threads * stride
+    bsp_worker_t* workers;
+    bsp_kernel_t kernel;
+    bsp_leader_t leader; // 可以是 NULL
+    void* arg; // 给 kernel / leader 用的共享数据
+};
+
+#define BSP_VALID 0xb5b5b5
+
+extern int bsp_init(bsp_t* bsp, int threads, size_t state_size,
+    bsp_kernel_t kernel, bsp_leader_t leader, void* arg);
+extern int bsp_destroy(bsp_t* bsp);
+
+/* 第 self 个线程的状态：run 之前用来初始化，leader 里用来读写所有线程的状态，run 之后用来取结果 */
+extern void* bsp_state(bsp_t* bsp, int self);
+
+/*
+ * 创建线程，跑 phases 个 phase，等所有线程结束才返回；可以多次调用。
+ * 创建线程失败的时候，已经创建的线程照样跑完 phases 个 phase（leader 看到的只有它们的结果），然后返回错误
+ */
+extern int bsp_run(bsp_t* bsp, int phases);
+
+#endif // __BSP_HXX__
@@ -3,6 +3,7 @@
 #include <pthread.h>
 
 #include "barrier.hxx"
+#include "bsp.hxx"
 #include "errors.hxx"
 
 #define THREADS 5
@@ -10,81 +11,74 @@
 #define INLOOPS 1000
 #define OUTLOOPS 10
 
+/* 每个线程自己的数据，bsp 会把它们放到不同的 cache line 上 */
 typedef struct thread_tag {
-    pthread_t thread_id;
-    int number;
     int increment;
     int arr[ARRAY];
 } thread_t;
 
-barrier_t barrier;
-thread_t thread[THREADS];
-
 /**
- * @brief 我的评价是：测试代码奇奇怪怪
+ * @brief 每个 phase：每个线程把自己的 arr 加 INLOOPS 次 increment
  *
  */
-void* thread_routine(void* arg)
+void thread_kernel(bsp_t* bsp, int self, int phase, void* state)
 {
-    int status;
-
-    thread_t* self = (thread_t*)arg;
-
-    for (int out_loop; out_loop < OUTLOOPS; out_loop++) {
-        status = barrier_wait(&barrier);
-        if (status > 0) {
-            HANDLE_STATUS("wait on barrier");
-        }
+    thread_t* thread = (thread_t*)state;
 
-        for (int in_loop = 0; in_loop < INLOOPS; in_loop++) {
-            for (int count = 0; count < ARRAY; count++) {
-                self->arr[count] += self->increment;
-            }
-        }
-
-        status = barrier_wait(&barrier);
-        if (status > 0) {
-            HANDLE_STATUS("wait on barrier");
-        }
-
-        if (status == -1) {
-            for (int thread_num = 0; thread_num < THREADS; thread_num++) {
-                thread[thread_num].increment += 1;
-            }
+    for (int in_loop = 0; in_loop < INLOOPS; in_loop++) {
+        for (int count = 0; count < ARRAY; count++) {
+            thread->arr[count] += thread->increment;
         }
     }
+}
 
-    return NULL;
+/**
+ * @brief 以前是拿到 -1 的线程在第二个 barrier 之后做的，
+ * 现在在 barrier 放行之前做，所以不需要每一轮开头的那个 barrier 了
+ */
+void thread_leader(bsp_t* bsp, int phase)
+{
+    for (int thread_num = 0; thread_num < THREADS; thread_num++) {
+        thread_t* thread = (thread_t*)bsp_state(bsp, thread_num);
+        thread->increment += 1;
+    }
 }
 
 int main(int arg, char* argv[])
 {
     int status;
+    bsp_t bsp;
 
-    barrier_init(&barrier, THREADS);
+    status = bsp_init(&bsp, THREADS, sizeof(thread_t), thread_kernel, thread_leader, NULL);
+    HANDLE_STATUS("init bsp");
 
     for (int thread_count = 0; thread_count < THREADS; thread_count++) {
-        thread[thread_count].increment = thread_count;
-        thread[thread_count].number = thread_count;
+        thread_t* thread = (thread_t*)bsp_state(&bsp, thread_count);
+        thread->increment = thread_count;
 
         for (int array_count = 0; array_count < ARRAY; array_count++) {
-            thread[thread_count].arr[array_count] = array_count + 1;
+            thread->arr[array_count] = array_count + 1;
         }
-
-        status = pthread_create(&thread[thread_count].thread_id, NULL,
-            thread_routine, (void*)&thread[thread_count]);
-        HANDLE_STATUS("create thread");
     }
 
+    status = bsp_run(&bsp, OUTLOOPS);
+    HANDLE_STATUS("run bsp");
+
     for (int thread_count = 0; thread_count < THREADS; thread_count++) {
-        status = pthread_join(thread[thread_count].thread_id, NULL);
-        HANDLE_STATUS("join thread");
+        thread_t* thread = (thread_t*)bsp_state(&bsp, thread_count);
 
-        printf("%02d: (%d) ", thread_count, thread[thread_count].increment);
+        printf("%02d: (%d) ", thread_count, thread->increment);
 
-        for (int array_count; array_count < ARRAY; array_count++) {
-            printf("%010u ", thread[thread_count].arr[array_count]);
+        for (int array_count = 0; array_count < ARRAY; array_count++) {
+            printf("%010u ", thread->arr[array_count]);
         }
         printf("\n");
     }
+
+#ifdef BARRIER_STATS
+    barrier_stats_dump(&bsp.barrier, stdout);
+#endif
+
+    status = bsp_destroy(&bsp);
+    HANDLE_STATUS("destroy bsp");
 }
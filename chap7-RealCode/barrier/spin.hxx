@@ -0,0 +1,77 @@
+#ifndef __SPIN_HXX__
+#define __SPIN_HXX__
+
+#include <climits>
+#include <cstddef>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief 自旋等待的时候调用，告诉 cpu 我们在忙等（x86 上就是 pause）
+ *
+ */
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#else
+    asm volatile("" ::: "memory");
+#endif
+}
+
+/* 睡眠之前最多自旋多少次 */
+#define SPIN_LIMIT 2048
+
+/**
+ * @brief 单核机器上自旋没有意义：我们在转，放行我们的线程却跑不了
+ *
+ */
+static inline int spin_limit(void)
+{
+    static const int spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_LIMIT : 0;
+    return spins;
+}
+
+/**
+ * 自适应自旋（和 glibc 的 PTHREAD_MUTEX_ADAPTIVE_NP 一样）：
+ * estimate 是最近几次 转了多少圈 的滑动平均，这次最多转 2 * estimate + SPIN_MIN 圈（不超过 spin_limit），
+ * 转完以后把这次的圈数按 1/8 的权重算进 estimate。
+ * 锁（或者一轮 barrier）平时放得快，estimate 就小，转不了几圈就能等到；放得慢就多转一些，直到 SPIN_LIMIT
+ */
+#define SPIN_MIN 10
+
+static inline int spin_budget(const int* estimate)
+{
+    int budget = 2 * __atomic_load_n(estimate, __ATOMIC_RELAXED) + SPIN_MIN;
+    int limit = spin_limit();
+    return budget < limit ? budget : limit;
+}
+
+static inline void spin_update(int* estimate, int spun)
+{
+    int old = __atomic_load_n(estimate, __ATOMIC_RELAXED);
+    __atomic_store_n(estimate, old + (spun - old) / 8, __ATOMIC_RELAXED); // 丢掉并发的更新也没关系，只是个估计
+}
+
+/**
+ * @brief 如果 *addr == val，那么睡眠；否则立即返回（EAGAIN）。
+ * 比较 与 睡眠 是内核里原子完成的，所以不会丢失唤醒
+ */
+static inline long futex_wait(unsigned int* addr, unsigned int val)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+/**
+ * @brief 唤醒 最多 n 个 睡在 addr 上的线程
+ *
+ */
+static inline long futex_wake(unsigned int* addr, int n)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+#endif // __SPIN_HXX__
@@ -0,0 +1,116 @@
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+
+#include "errors.hxx"
+#include "spin.hxx"
+#include "tbarrier.hxx"
+
+int tbarrier_init(tbarrier_t* barrier, int count)
+{
+    if (count <= 0 || count > (1 << TBARRIER_ROUNDS)) {
+        return EINVAL;
+    }
+
+    size_t size = count * sizeof(tbarrier_node_t);
+    barrier->nodes = (tbarrier_node_t*)aligned_alloc(alignof(tbarrier_node_t), size);
+    if (barrier->nodes == NULL) {
+        return ENOMEM;
+    }
+    memset(barrier->nodes, 0, size);
+
+    for (int i = 0; i < count; i++) {
+        barrier->nodes[i].sense = 1; // flag 一开始都是 0，第一轮等它们变成 1
+    }
+
+    /* rounds = ceil(log2(count)) */
+    barrier->rounds = 0;
+    while ((1 << barrier->rounds) < count) {
+        barrier->rounds++;
+    }
+
+    barrier->count = count;
+    barrier->valid = TBARRIER_VALID;
+
+    return 0;
+}
+
+int tbarrier_destroy(tbarrier_t* barrier)
+{
+    if (barrier->valid != TBARRIER_VALID) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < barrier->count; i++) {
+        if (__atomic_load_n(&barrier->nodes[i].parked, __ATOMIC_ACQUIRE)) {
+            return EBUSY;
+        }
+    }
+
+    barrier->valid = 0;
+    free(barrier->nodes);
+
+    return 0;
+}
+
+/**
+ * @brief 等待 *flag 变成 sense：先自旋，再睡在 flag 上
+ *
+ */
+static void tbarrier_await(tbarrier_node_t* self, unsigned int* flag, unsigned int sense)
+{
+    int spins = spin_limit();
+    for (int spin = 0; spin < spins; spin++) {
+        if (__atomic_load_n(flag, __ATOMIC_ACQUIRE) == sense) {
+            return;
+        }
+        cpu_relax();
+    }
+
+    /* 和 partner 的 (写 flag，读 parked) 配对：要么 partner 看到 parked，要么 futex_wait 看到新的 flag */
+    __atomic_store_n(&self->parked, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(flag, __ATOMIC_SEQ_CST) != sense) {
+        futex_wait(flag, sense ^ 1);
+    }
+    __atomic_store_n(&self->parked, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * 和 barrier_wait 一样：恰好一个线程（self == 0）返回 -1，其他返回 0，出错返回错误码
+ *
+ * parity 让相邻两次 barrier 用不同的 flag，快的线程进入下一次 barrier 时不会踩到慢线程还没读的 flag；
+ * 每用完两次 flag（parity 回到 0），sense 翻转一次
+ */
+int tbarrier_wait(tbarrier_t* barrier, int self)
+{
+    if (barrier->valid != TBARRIER_VALID) {
+        return EINVAL;
+    }
+
+    if (self < 0 || self >= barrier->count) {
+        return EINVAL;
+    }
+
+    tbarrier_node_t* node = &barrier->nodes[self];
+    unsigned int parity = node->parity;
+    unsigned int sense = node->sense;
+
+    for (int round = 0; round < barrier->rounds; round++) {
+        tbarrier_node_t* partner = &barrier->nodes[(self + (1 << round)) % barrier->count];
+        unsigned int* flag = &partner->round[round].flag[parity];
+
+        __atomic_store_n(flag, sense, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&partner->parked, __ATOMIC_SEQ_CST)) {
+            futex_wake(flag, 1);
+        }
+
+        tbarrier_await(node, &node->round[round].flag[parity], sense);
+    }
+
+    if (parity == 1) {
+        node->sense = sense ^ 1;
+    }
+    node->parity = parity ^ 1;
+
+    return self == 0 ? -1 : 0;
+}
@@ -0,0 +1,42 @@
+#include <pthread.h>
+
+#ifndef __TBARRIER_HXX__
+#define __TBARRIER_HXX__
+
+/**
+ * dissemination barrier：第 r 轮，线程 i 通知线程 (i + 2^r) % count，
+ * 然后等线程 (i - 2^r) % count 通知自己。ceil(log2(count)) 轮之后，所有人都到了。
+ *
+ * 没有中心计数器：每个 flag 只有一个线程写、一个线程读，而且每一轮的 flag 独占一个 cache line
+ * （同一轮的两个 parity 由同一个 partner 写，可以放在一起），不同轮的 partner 不会互相抢。
+ * 代价是：线程要告诉 barrier 自己是第几个（0 ~ count-1）
+ */
+
+#define TBARRIER_ROUNDS 16 // 最多 2^16 个线程
+
+typedef struct tbarrier_round_tag {
+    alignas(64) unsigned int flag[2]; // 下标是 parity；由这一轮的 partner 写，自己读
+} tbarrier_round_t;
+
+typedef struct tbarrier_node_tag {
+    tbarrier_round_t round[TBARRIER_ROUNDS];
+    alignas(64) unsigned int parity; // 下面两个只有自己读写：用 flag[parity]，等 flag == sense
+    unsigned int sense;
+    int parked; // 自己是否睡在 futex 上，partner 据此决定要不要 futex_wake
+} tbarrier_node_t;
+
+typedef struct tbarrier_tag {
+    tbarrier_node_t* nodes; // count 个，cache line 对齐
+    int valid;
+    int count;
+    int rounds;
+} tbarrier_t;
+
+#define TBARRIER_VALID 0xdbcaff
+
+/* nodes 要 malloc，所以没有 TBARRIER_INITIALIZER */
+extern int tbarrier_init(tbarrier_t* barrier, int count);
+extern int tbarrier_destroy(tbarrier_t* barrier);
+extern int tbarrier_wait(tbarrier_t* barrier, int self);
+
+#endif // __TBARRIER_HXX__
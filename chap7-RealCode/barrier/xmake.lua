@@ -5,7 +5,17 @@ set_toolchains("@llvm")
 
 target("brr") do
     set_kind("binary")
-    add_files("./*.cxx")
+    add_files("./*.cxx|bench.cxx")
 	set_languages("cxx20")
 	set_targetdir("./build")
-end
\ No newline at end of file
+	-- add_defines("BARRIER_STATS") -- 打开掉队线程统计
+end
+
+-- barrier 延迟测试：barrier_t / tbarrier_t / pthread_barrier_t / std::barrier
+target("brr_bench") do
+    set_kind("binary")
+    add_files("./bench.cxx", "./barrier.cxx", "./barrier_stats.cxx", "./tbarrier.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
@@ -0,0 +1,204 @@
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+#include "brlock.hxx"
+#include "errors.hxx"
+#include "spin.hxx"
+
+static int brl_next_slot; // 新线程依次分到 slot
+static thread_local int brl_self = -1;
+
+/**
+ * @brief 当前线程的 slot：第一次用的时候分配，以后一直不变
+ *
+ */
+static int brl_slot(void)
+{
+    if (brl_self < 0) {
+        brl_self = __atomic_fetch_add(&brl_next_slot, 1, __ATOMIC_RELAXED) % BRL_SLOTS;
+    }
+    return brl_self;
+}
+
+int brl_init(brlock_t* brl)
+{
+    int status;
+
+    brl->writer = 0;
+    memset(brl->slots, 0, sizeof(brl->slots));
+
+    status = pthread_mutex_init(&brl->mutex, NULL);
+    if (status != 0) {
+        return status;
+    }
+
+    brl->valid = BRLOCK_VALID;
+
+    return 0;
+}
+
+int brl_destroy(brlock_t* brl)
+{
+    int status;
+
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_trylock(&brl->mutex);
+    if (status != 0) {
+        return status; // EBUSY：有写者
+    }
+
+    for (int i = 0; i < BRL_SLOTS; i++) {
+        if (__atomic_load_n(&brl->slots[i].readers, __ATOMIC_ACQUIRE) != 0) {
+            pthread_mutex_unlock(&brl->mutex);
+            return EBUSY;
+        }
+    }
+
+    brl->valid = 0;
+    status = pthread_mutex_unlock(&brl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    return pthread_mutex_destroy(&brl->mutex);
+}
+
+/**
+ * 读者：先把自己的 slot +1，再看 writer；写者：先置 writer，再看所有 slot。
+ * 两边的 store 和 load 都是 SEQ_CST（写者读 slot 也是，ACQUIRE 的 load 不在全序里），所以至少有一方能看到另一方：要么读者看到写者、退出来排队，要么写者看到读者、等它走
+ */
+int brl_readlock(brlock_t* brl)
+{
+    int status;
+
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    brl_slot_t* slot = &brl->slots[brl_slot()];
+
+    while (1) {
+        __atomic_add_fetch(&slot->readers, 1, __ATOMIC_SEQ_CST);
+        if (!__atomic_load_n(&brl->writer, __ATOMIC_SEQ_CST)) {
+            return 0;
+        }
+
+        /* 有写者：撤回，然后在 mutex 上等它写完（写者在整个写的期间都持有 mutex） */
+        __atomic_sub_fetch(&slot->readers, 1, __ATOMIC_RELEASE);
+
+        status = pthread_mutex_lock(&brl->mutex);
+        if (status != 0) {
+            return status;
+        }
+        status = pthread_mutex_unlock(&brl->mutex);
+        if (status != 0) {
+            return status;
+        }
+    }
+}
+
+int brl_readtrylock(brlock_t* brl)
+{
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    brl_slot_t* slot = &brl->slots[brl_slot()];
+
+    __atomic_add_fetch(&slot->readers, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&brl->writer, __ATOMIC_SEQ_CST)) {
+        __atomic_sub_fetch(&slot->readers, 1, __ATOMIC_RELEASE);
+        return EBUSY;
+    }
+
+    return 0;
+}
+
+int brl_readunlock(brlock_t* brl)
+{
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    __atomic_sub_fetch(&brl->slots[brl_slot()].readers, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * @brief 等所有 slot 里的读者离开；新来的读者会看到 writer，不会再进来
+ *
+ */
+static void brl_drain(brlock_t* brl)
+{
+    int spins = spin_limit();
+
+    for (int i = 0; i < BRL_SLOTS; i++) {
+        for (int spin = 0; __atomic_load_n(&brl->slots[i].readers, __ATOMIC_SEQ_CST) != 0; spin++) {
+            if (spin < spins) {
+                cpu_relax();
+            } else {
+                sched_yield();
+            }
+        }
+    }
+}
+
+int brl_writelock(brlock_t* brl)
+{
+    int status;
+
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_lock(&brl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    __atomic_store_n(&brl->writer, 1, __ATOMIC_SEQ_CST);
+    brl_drain(brl);
+
+    return 0;
+}
+
+int brl_writetrylock(brlock_t* brl)
+{
+    int status;
+
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_trylock(&brl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    __atomic_store_n(&brl->writer, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < BRL_SLOTS; i++) {
+        if (__atomic_load_n(&brl->slots[i].readers, __ATOMIC_SEQ_CST) != 0) {
+            __atomic_store_n(&brl->writer, 0, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&brl->mutex);
+            return EBUSY;
+        }
+    }
+
+    return 0;
+}
+
+int brl_writeunlock(brlock_t* brl)
+{
+    if (brl->valid != BRLOCK_VALID) {
+        return EINVAL;
+    }
+
+    __atomic_store_n(&brl->writer, 0, __ATOMIC_RELEASE);
+
+    return pthread_mutex_unlock(&brl->mutex);
+}
@@ -0,0 +1,53 @@
+#ifndef __BRLOCK_HXX__
+#define __BRLOCK_HXX__
+
+#include <pthread.h>
+
+/**
+ * big-reader lock：给 读非常多、写非常少 的数据用（配置、路由表）
+ *
+ * 每个线程固定用一个 slot（线程多于 BRL_SLOTS 的时候几个线程共用一个），slot 各占一个 cache line。
+ * 读者只改自己 slot 的计数，然后看一眼 writer，所以读者之间不会抢同一个 cache line，
+ * 读的开销不随核数增长；代价是写者要扫一遍所有的 slot，等它们都变成 0
+ *
+ * 读锁必须在加锁的同一个线程上释放
+ */
+#define BRL_SLOTS 64
+
+typedef struct brl_slot_tag {
+    alignas(64) int readers;
+} brl_slot_t;
+
+typedef struct brlock_tag {
+    pthread_mutex_t mutex; // 写者之间互斥，写者持有它直到 brl_writeunlock；碰到写者的读者也在这里排队
+    int valid;
+    int writer; // 有写者正在进入或者持有锁
+    brl_slot_t slots[BRL_SLOTS];
+} brlock_t;
+
+#define BRLOCK_VALID 0xbfacade
+
+#define BRL_INITIALIZER            \
+    {                              \
+        PTHREAD_MUTEX_INITIALIZER, \
+            BRLOCK_VALID,          \
+            0                      \
+    }
+
+extern int brl_init(brlock_t* brl);
+
+extern int brl_destroy(brlock_t* brl);
+
+extern int brl_readlock(brlock_t* brl);
+
+extern int brl_readtrylock(brlock_t* brl);
+
+extern int brl_readunlock(brlock_t* brl);
+
+extern int brl_writelock(brlock_t* brl);
+
+extern int brl_writetrylock(brlock_t* brl);
+
+extern int brl_writeunlock(brlock_t* brl);
+
+#endif
@@ -0,0 +1,190 @@
+#include <cstring>
+#include <pthread.h>
+
+#include "combine.hxx"
+#include "errors.hxx"
+#include "spin.hxx"
+
+int rwl_fc_init(rwl_fc_t* fc, rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+
+    fc->rwlock = rwl;
+    fc->used = 0;
+    memset(fc->slots, 0, sizeof(fc->slots));
+    fc->valid = RWL_FC_VALID;
+
+    return 0;
+}
+
+int rwl_fc_destroy(rwl_fc_t* fc)
+{
+    if (fc->valid != RWL_FC_VALID) {
+        return EINVAL;
+    }
+
+    for (int i = 0; i < RWL_FC_SLOTS; i++) {
+        if (__atomic_load_n(&fc->slots[i], __ATOMIC_ACQUIRE) != NULL) {
+            return EBUSY;
+        }
+    }
+
+    fc->valid = 0;
+    return 0;
+}
+
+int rwl_fc_register(rwl_fc_t* fc, rwl_fc_slot_t* slot)
+{
+    if (fc->valid != RWL_FC_VALID) {
+        return EINVAL;
+    }
+
+    slot->op = NULL;
+    slot->arg = NULL;
+    slot->pending = RWL_FC_IDLE;
+
+    for (int i = 0; i < RWL_FC_SLOTS; i++) {
+        rwl_fc_slot_t* empty = NULL;
+        if (__atomic_compare_exchange_n(&fc->slots[i], &empty, slot,
+                false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            int used = __atomic_load_n(&fc->used, __ATOMIC_RELAXED);
+            while (used < i + 1
+                && !__atomic_compare_exchange_n(&fc->used, &used, i + 1,
+                    true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            }
+            return 0;
+        }
+    }
+
+    return EAGAIN; // 已经有 RWL_FC_SLOTS 个写者了
+}
+
+/**
+ * combiner 是拿着写锁扫 slots 的，它读到的 slot 指针在放锁之前一直可能被用到（下一遍还会再读 pending），
+ * 所以摘掉 slot 也要拿写锁：返回以后没有 combiner 还拿着这个指针，调用者可以释放或者复用 slot
+ */
+int rwl_fc_unregister(rwl_fc_t* fc, rwl_fc_slot_t* slot)
+{
+    int status, status2;
+
+    if (fc->valid != RWL_FC_VALID) {
+        return EINVAL;
+    }
+    if (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) != RWL_FC_IDLE) {
+        return EBUSY;
+    }
+
+    status = rwl_writelock(fc->rwlock);
+    if (status != 0) {
+        return status;
+    }
+
+    status = EINVAL;
+    for (int i = 0; i < RWL_FC_SLOTS; i++) {
+        if (__atomic_load_n(&fc->slots[i], __ATOMIC_RELAXED) == slot) {
+            __atomic_store_n(&fc->slots[i], (rwl_fc_slot_t*)NULL, __ATOMIC_RELAXED);
+            status = 0;
+            break;
+        }
+    }
+
+    status2 = rwl_writeunlock(fc->rwlock);
+    return status != 0 ? status : status2;
+}
+
+/**
+ * @brief 持有写锁时调用：把所有挂着的操作做掉
+ *
+ * pending 的 acquire / release 配对：挂操作的线程写的 op、arg 对我们可见，我们做完的结果对它可见。
+ * 先用 CAS 把 POSTED 改成 RUNNING 认领，挂它的线程出错撤回（rwl_fc_withdraw）的时候就不会两边都以为归自己。
+ * 扫一遍没有找到新的操作就停下来，最多扫 RWL_FC_PASSES 遍，免得一直被新来的操作拖住不放锁
+ */
+static void rwl_fc_combine(rwl_fc_t* fc)
+{
+    int used = __atomic_load_n(&fc->used, __ATOMIC_ACQUIRE);
+
+    for (int pass = 0; pass < RWL_FC_PASSES; pass++) {
+        int done = 0;
+        for (int i = 0; i < used; i++) {
+            rwl_fc_slot_t* slot = __atomic_load_n(&fc->slots[i], __ATOMIC_ACQUIRE);
+            if (slot == NULL) {
+                continue;
+            }
+            int posted = RWL_FC_POSTED;
+            if (!__atomic_compare_exchange_n(&slot->pending, &posted, RWL_FC_RUNNING,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                continue;
+            }
+            slot->op(slot->arg);
+            __atomic_store_n(&slot->pending, RWL_FC_IDLE, __ATOMIC_RELEASE);
+            done++;
+        }
+        if (done == 0) {
+            break;
+        }
+    }
+}
+
+/**
+ * @brief 拿锁出错的时候撤回自己挂着的操作
+ *
+ * 撤回成功：op 没有人做过，也不会再有人做，返回 status；
+ * 已经被 combiner 认领了：等它做完，这次写其实成功了，返回 0
+ */
+static int rwl_fc_withdraw(rwl_fc_slot_t* slot, int status)
+{
+    int posted = RWL_FC_POSTED;
+
+    if (__atomic_compare_exchange_n(&slot->pending, &posted, RWL_FC_IDLE,
+            false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        return status;
+    }
+    while (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) != RWL_FC_IDLE) {
+        cpu_relax();
+    }
+    return 0;
+}
+
+/**
+ * 先挂上操作，然后：
+ *   - 写锁没人拿（rwl_writetrylock 成功）：自己当 combiner；
+ *   - 有人拿着：多半就是一个 combiner，自旋等它把我们的 slot 清掉；
+ *   - 自旋了 spin_limit 次还没做完（锁被读者或者普通写者拿着）：在 rwl_writelock 里睡，醒来以后自己当 combiner；
+ *   - 拿锁出错：撤回挂着的操作再返回错误，免得以后被别人做掉（那时候 arg 可能已经没了）
+ */
+int rwl_fc_write(rwl_fc_t* fc, rwl_fc_slot_t* slot, void (*op)(void*), void* arg)
+{
+    int status;
+    int spins = spin_limit();
+
+    if (fc->valid != RWL_FC_VALID) {
+        return EINVAL;
+    }
+
+    slot->op = op;
+    slot->arg = arg;
+    __atomic_store_n(&slot->pending, RWL_FC_POSTED, __ATOMIC_RELEASE);
+
+    for (int spin = 0; spin < spins; spin++) {
+        if (__atomic_load_n(&slot->pending, __ATOMIC_ACQUIRE) == RWL_FC_IDLE) {
+            return 0; // 别人替我们做了
+        }
+        status = rwl_writetrylock(fc->rwlock);
+        if (status == 0) {
+            rwl_fc_combine(fc);
+            return rwl_writeunlock(fc->rwlock);
+        } else if (status != EBUSY) {
+            return rwl_fc_withdraw(slot, status);
+        }
+        cpu_relax();
+    }
+
+    status = rwl_writelock(fc->rwlock);
+    if (status != 0) {
+        return rwl_fc_withdraw(slot, status);
+    }
+    rwl_fc_combine(fc); // 我们的操作可能已经被做了，没关系，顺便做掉别人的
+    return rwl_writeunlock(fc->rwlock);
+}
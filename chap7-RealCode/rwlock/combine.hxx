@@ -0,0 +1,56 @@
+#ifndef __COMBINE_HXX__
+#define __COMBINE_HXX__
+
+#include <pthread.h>
+
+#include "rwlock.hxx"
+
+/**
+ * flat combining：很多线程都要做很短的写操作的时候，不让它们一个一个地 rwl_writelock / rwl_writeunlock
+ * （每次交接都是一次 cond_signal，一次上下文切换），而是把操作挂到自己的 slot 上，
+ * 谁拿到写锁，谁就把所有挂着的操作一批做完，别的线程只需要等自己的 slot 被清掉。
+ * 数据在这一批里一直留在同一个 cpu 的 cache 里
+ *
+ * 每个写者线程先 rwl_fc_register 一个自己的 rwl_fc_slot_t（最多 RWL_FC_SLOTS 个），退出前 rwl_fc_unregister
+ * （它会拿一下写锁，等正在扫 slots 的 combiner 做完），之后 slot 才能释放。
+ * 读者照常用 rwl_readlock；不走 combining 的写者照常用 rwl_writelock，两者可以混用
+ *
+ * 操作是在 别的线程 上执行的：不能依赖 thread_local，也不能再去拿这把锁
+ */
+#define RWL_FC_SLOTS 64
+#define RWL_FC_PASSES 4 // combiner 最多扫几遍（做的时候可能又有新的操作挂上来）
+
+typedef struct rwl_fc_slot_tag {
+    alignas(64) void (*op)(void* arg);
+    void* arg;
+    int pending; // RWL_FC_IDLE / RWL_FC_POSTED / RWL_FC_RUNNING
+} rwl_fc_slot_t;
+
+#define RWL_FC_IDLE 0 // 没有挂着的操作，或者已经做完了
+#define RWL_FC_POSTED 1 // op 挂着，还没人做；combiner 和 挂它的线程 谁先 CAS 走谁说了算
+#define RWL_FC_RUNNING 2 // 某个 combiner 认领了，正在做
+
+typedef struct rwl_fc_tag {
+    rwlock_t* rwlock;
+    int valid;
+    int used; // 用到过的 slot 的最大下标 + 1，combiner 只扫到这里
+    rwl_fc_slot_t* slots[RWL_FC_SLOTS];
+} rwl_fc_t;
+
+#define RWL_FC_VALID 0xfcacade
+
+extern int rwl_fc_init(rwl_fc_t* fc, rwlock_t* rwlock);
+
+extern int rwl_fc_destroy(rwl_fc_t* fc);
+
+extern int rwl_fc_register(rwl_fc_t* fc, rwl_fc_slot_t* slot);
+
+extern int rwl_fc_unregister(rwl_fc_t* fc, rwl_fc_slot_t* slot);
+
+/**
+ * 在写锁下执行 op(arg)：可能是自己做（顺便做掉别人的），也可能是别的 combiner 替我们做的。
+ * 返回的时候 op 已经做完了，它的结果对我们可见
+ */
+extern int rwl_fc_write(rwl_fc_t* fc, rwl_fc_slot_t* slot, void (*op)(void*), void* arg);
+
+#endif
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "combine.hxx"
+#include "errors.hxx"
+#include "rwlock.hxx"
+
+/**
+ * 写吞吐：每个线程不停地做很短的写操作（给一个小数组里的计数加一），
+ * 分别用 rwl_writelock / rwl_writeunlock 和 rwl_fc_write，看线程数翻倍的时候总的写吞吐怎么变
+ *
+ * usage: rw_combine [max threads] [seconds]
+ */
+
+#define COUNTERS 8
+
+typedef struct writer_tag {
+    alignas(64) pthread_t thread_id;
+    unsigned int seed;
+    long writes;
+} writer_t;
+
+static rwlock_t rwlock = RWL_INITIALIZER;
+static rwl_fc_t fc;
+static long counters[COUNTERS];
+static int use_fc;
+static int stop;
+
+static void increment(void* arg)
+{
+    counters[(long)arg]++;
+}
+
+static void* writer_routine(void* arg)
+{
+    int status;
+    writer_t* self = (writer_t*)arg;
+    rwl_fc_slot_t slot;
+
+    if (use_fc) {
+        status = rwl_fc_register(&fc, &slot);
+        HANDLE_STATUS("register slot");
+    }
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        long index = rand_r(&self->seed) % COUNTERS;
+        if (use_fc) {
+            status = rwl_fc_write(&fc, &slot, increment, (void*)index);
+            HANDLE_STATUS("combining write");
+        } else {
+            status = rwl_writelock(&rwlock);
+            HANDLE_STATUS("write lock");
+            increment((void*)index);
+            status = rwl_writeunlock(&rwlock);
+            HANDLE_STATUS("write unlock");
+        }
+        self->writes++;
+    }
+
+    if (use_fc) {
+        status = rwl_fc_unregister(&fc, &slot);
+        HANDLE_STATUS("unregister slot");
+    }
+    return NULL;
+}
+
+static double run(int threads, int seconds)
+{
+    int status;
+    std::vector<writer_t> writers(threads);
+
+    stop = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        counters[i] = 0;
+    }
+
+    for (int i = 0; i < threads; i++) {
+        writers[i].seed = i + 1;
+        writers[i].writes = 0;
+        status = pthread_create(&writers[i].thread_id, NULL, writer_routine, &writers[i]);
+        HANDLE_STATUS("create writer");
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long writes = 0;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(writers[i].thread_id, NULL);
+        HANDLE_STATUS("join writer");
+        writes += writers[i].writes;
+    }
+
+    long total = 0;
+    for (int i = 0; i < COUNTERS; i++) {
+        total += counters[i];
+    }
+    if (total != writes) {
+        fprintf(stderr, "lost updates: %ld != %ld\n", total, writes);
+        abort();
+    }
+
+    return (double)writes / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    int status;
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = 1;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    if (max_threads <= 0 || max_threads > RWL_FC_SLOTS || seconds <= 0) {
+        fprintf(stderr, "usage: %s [max threads <= %d] [seconds]\n", argv[0], RWL_FC_SLOTS);
+        return 1;
+    }
+
+    status = rwl_fc_init(&fc, &rwlock);
+    HANDLE_STATUS("init combining");
+
+    printf("%d s per run\n", seconds);
+    printf("%8s %14s %14s %8s\n", "writers", "writelock w/s", "combining w/s", "ratio");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        use_fc = 0;
+        double plain = run(threads, seconds);
+        use_fc = 1;
+        double combined = run(threads, seconds);
+        printf("%8d %14.0f %14.0f %8.2f\n", threads, plain, combined, combined / plain);
+    }
+
+    status = rwl_fc_destroy(&fc);
+    HANDLE_STATUS("destroy combining");
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "rwlock.hxx"
+
+/**
+ * 公平性测试：95% 读、5% 写，每个线程不停地加锁、做一点工作、解锁。
+ * 记录每一次 rwl_writelock 等了多久，看看三种策略下写者的等待是不是有界的
+ *
+ * usage: rw_fair [threads] [seconds] [write percent]
+ */
+
+#define READ_WORK 2000 // 读临界区里的空转次数
+#define WRITE_WORK 1000
+
+typedef struct worker_tag {
+    alignas(64) pthread_t thread_id;
+    unsigned int seed;
+    long reads;
+    std::vector<long> write_waits; // ns
+} worker_t;
+
+static rwlock_t rwlock;
+static int stop;
+static int write_percent = 5;
+static long shared_data;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void work(int loops)
+{
+    for (int i = 0; i < loops; i++) {
+        asm volatile("" ::: "memory");
+    }
+}
+
+static void* worker_routine(void* arg)
+{
+    int status;
+    worker_t* self = (worker_t*)arg;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        if ((int)(rand_r(&self->seed) % 100) < write_percent) {
+            long start = now_ns();
+            status = rwl_writelock(&rwlock);
+            HANDLE_STATUS("write lock");
+            self->write_waits.push_back(now_ns() - start);
+            shared_data++;
+            work(WRITE_WORK);
+            status = rwl_writeunlock(&rwlock);
+            HANDLE_STATUS("write unlock");
+        } else {
+            status = rwl_readlock(&rwlock);
+            HANDLE_STATUS("read lock");
+            work(READ_WORK);
+            status = rwl_readunlock(&rwlock);
+            HANDLE_STATUS("read unlock");
+            self->reads++;
+        }
+    }
+
+    return NULL;
+}
+
+static void run(const char* name, int policy, int threads, int seconds)
+{
+    int status;
+    std::vector<worker_t> workers(threads);
+
+    status = rwl_init_policy(&rwlock, policy);
+    HANDLE_STATUS("init rwlock");
+    rwl_stats_name(&rwlock, name); // 没有 -DRWLOCK_STATS 的时候是 ENOSYS，不管它
+    stop = 0;
+
+    for (int i = 0; i < threads; i++) {
+        workers[i].seed = i + 1;
+        workers[i].reads = 0;
+        workers[i].write_waits.reserve(1 << 16);
+        status = pthread_create(&workers[i].thread_id, NULL, worker_routine, &workers[i]);
+        HANDLE_STATUS("create thread");
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long reads = 0;
+    std::vector<long> waits;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(workers[i].thread_id, NULL);
+        HANDLE_STATUS("join thread");
+        reads += workers[i].reads;
+        waits.insert(waits.end(), workers[i].write_waits.begin(), workers[i].write_waits.end());
+    }
+
+    std::sort(waits.begin(), waits.end());
+    long p50 = waits.empty() ? 0 : waits[waits.size() / 2];
+    long p99 = waits.empty() ? 0 : waits[(waits.size() - 1) * 99 / 100];
+    long max = waits.empty() ? 0 : waits.back();
+    printf("%-14s %12.0f %12.0f %12ld %12ld %12ld\n", name,
+        (double)reads / seconds, (double)waits.size() / seconds, p50 / 1000, p99 / 1000, max / 1000);
+
+    rwl_stats_dump(name, stdout);
+    status = rwl_destroy(&rwlock);
+    HANDLE_STATUS("destroy rwlock");
+}
+
+int main(int argc, char* argv[])
+{
+    int threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = 2;
+
+    if (threads < 4) {
+        threads = 4;
+    }
+    if (argc > 1) {
+        threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        write_percent = atoi(argv[3]);
+    }
+    if (threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [threads] [seconds] [write percent]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%d threads, %d%% writes, %d s per policy\n", threads, write_percent, seconds);
+    printf("%-14s %12s %12s %12s %12s %12s\n", "policy", "reads/s", "writes/s",
+        "w-wait p50", "w-wait p99", "w-wait max");
+    printf("(writer wait in us)\n");
+
+    run("prefer-reader", RWL_PREFER_READER, threads, seconds);
+    run("prefer-writer", RWL_PREFER_WRITER, threads, seconds);
+    run("phase-fair", RWL_PHASE_FAIR, threads, seconds);
+
+    return 0;
+}
@@ -0,0 +1,435 @@
+#include <cstdlib>
+#include <pthread.h>
+
+#include "errors.hxx"
+#include "hashmap.hxx"
+
+/**
+ * @brief splitmix64 的收尾：key 往往是连续的整数，低位要打散，不然都挤在几个 stripe 上
+ *
+ */
+static unsigned long hm_hash(unsigned long key)
+{
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9UL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebUL;
+    key ^= key >> 31;
+    return key;
+}
+
+static hm_stripe_t* hm_stripe(hashmap_t* map, unsigned long hash)
+{
+    return &map->stripe[hash & (map->stripes - 1)];
+}
+
+/**
+ * @brief 持有 hash 所在 stripe 的锁时调用：key 现在应该在哪个桶里
+ *
+ * 旧桶 ob 是这个 stripe 的第 ob / stripes 个桶，比 cursor 小就已经搬到新表里了
+ */
+static hm_node_t** hm_bucket(hashmap_t* map, unsigned long hash)
+{
+    if (map->old != NULL) {
+        unsigned long ob = hash & (map->old_size - 1);
+        if (ob / map->stripes >= hm_stripe(map, hash)->cursor) {
+            return &map->old[ob];
+        }
+    }
+    return &map->buckets[hash & (map->size - 1)];
+}
+
+int hm_init(hashmap_t* map, int stripes, unsigned long size)
+{
+    int status;
+
+    if (stripes <= 0 || (stripes & (stripes - 1)) != 0) {
+        return EINVAL;
+    }
+
+    map->stripes = stripes;
+    map->size = stripes;
+    while (map->size < size) {
+        map->size *= 2;
+    }
+    map->old = NULL;
+    map->old_size = 0;
+    map->migrating = 0;
+
+    map->buckets = (hm_node_t**)calloc(map->size, sizeof(hm_node_t*));
+    if (map->buckets == NULL) {
+        return ENOMEM;
+    }
+
+    map->stripe = (hm_stripe_t*)aligned_alloc(64, stripes * sizeof(hm_stripe_t));
+    if (map->stripe == NULL) {
+        free(map->buckets);
+        return ENOMEM;
+    }
+
+    for (int i = 0; i < stripes; i++) {
+        map->stripe[i].count = 0;
+        map->stripe[i].cursor = 0;
+        status = rwl_init(&map->stripe[i].lock);
+        if (status != 0) {
+            while (--i >= 0) {
+                rwl_destroy(&map->stripe[i].lock);
+            }
+            free(map->stripe);
+            free(map->buckets);
+            return status;
+        }
+    }
+
+    status = pthread_mutex_init(&map->resize, NULL);
+    if (status != 0) {
+        for (int i = 0; i < stripes; i++) {
+            rwl_destroy(&map->stripe[i].lock);
+        }
+        free(map->stripe);
+        free(map->buckets);
+        return status;
+    }
+
+    map->valid = HASHMAP_VALID;
+
+    return 0;
+}
+
+static void hm_free_buckets(hm_node_t** buckets, unsigned long size)
+{
+    for (unsigned long b = 0; b < size; b++) {
+        hm_node_t* node = buckets[b];
+        while (node != NULL) {
+            hm_node_t* next = node->next;
+            free(node);
+            node = next;
+        }
+    }
+    free(buckets);
+}
+
+int hm_destroy(hashmap_t* map)
+{
+    int status;
+
+    if (map->valid != HASHMAP_VALID) {
+        return EINVAL;
+    }
+
+    for (unsigned long i = 0; i < map->stripes; i++) {
+        status = rwl_destroy(&map->stripe[i].lock);
+        if (status != 0) {
+            return status; // EBUSY：还有人在用；前面的 stripe 已经毁掉了，这张表也不能再用了
+        }
+    }
+    map->valid = 0;
+
+    hm_free_buckets(map->buckets, map->size);
+    if (map->old != NULL) {
+        hm_free_buckets(map->old, map->old_size);
+    }
+    free(map->stripe);
+
+    return pthread_mutex_destroy(&map->resize);
+}
+
+int hm_find(hashmap_t* map, unsigned long key, void** value)
+{
+    int status;
+
+    if (map->valid != HASHMAP_VALID) {
+        return EINVAL;
+    }
+
+    unsigned long hash = hm_hash(key);
+    hm_stripe_t* stripe = hm_stripe(map, hash);
+
+    status = rwl_readlock(&stripe->lock);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    status = ENOENT;
+    for (hm_node_t* node = *hm_bucket(map, hash); node != NULL; node = node->next) {
+        if (node->key == key) {
+            *value = node->value;
+            status = 0;
+            break;
+        }
+    }
+    /* 解锁 */
+    rwl_readunlock(&stripe->lock);
+    return status;
+}
+
+/**
+ * @brief 持有所有 stripe 的写锁（按下标从小到大拿，不会死锁）
+ *
+ */
+static int hm_lockall(hashmap_t* map)
+{
+    int status;
+
+    status = pthread_mutex_lock(&map->resize);
+    if (status != 0) {
+        return status;
+    }
+    for (unsigned long i = 0; i < map->stripes; i++) {
+        status = rwl_writelock(&map->stripe[i].lock);
+        if (status != 0) {
+            while (i-- > 0) {
+                rwl_writeunlock(&map->stripe[i].lock);
+            }
+            pthread_mutex_unlock(&map->resize);
+            return status;
+        }
+    }
+    return 0;
+}
+
+static void hm_unlockall(hashmap_t* map)
+{
+    for (unsigned long i = map->stripes; i-- > 0;) {
+        rwl_writeunlock(&map->stripe[i].lock);
+    }
+    pthread_mutex_unlock(&map->resize);
+}
+
+/**
+ * @brief 开始扩容：只分配新表、换指针，数据以后再慢慢搬
+ *
+ * 新表先在锁外面分配好；拿到锁以后如果发现别人已经开始扩容了，就把它扔掉
+ */
+static int hm_grow(hashmap_t* map, unsigned long size)
+{
+    int status;
+
+    hm_node_t** buckets = (hm_node_t**)calloc(size * 2, sizeof(hm_node_t*));
+    if (buckets == NULL) {
+        return ENOMEM;
+    }
+
+    status = hm_lockall(map);
+    if (status != 0) {
+        free(buckets);
+        return status;
+    }
+    if (map->old != NULL || map->size != size) {
+        hm_unlockall(map);
+        free(buckets);
+        return 0;
+    }
+
+    map->old = map->buckets;
+    map->old_size = map->size;
+    map->buckets = buckets;
+    map->size = size * 2;
+    map->migrating = map->stripes;
+    for (unsigned long i = 0; i < map->stripes; i++) {
+        map->stripe[i].cursor = 0;
+    }
+
+    hm_unlockall(map);
+    return 0;
+}
+
+/**
+ * @brief 结束扩容：所有旧桶都空了，释放旧表
+ *
+ */
+static int hm_finish(hashmap_t* map)
+{
+    int status;
+
+    status = hm_lockall(map);
+    if (status != 0) {
+        return status;
+    }
+    hm_node_t** old = map->old;
+    map->old = NULL;
+    map->old_size = 0;
+    hm_unlockall(map);
+
+    free(old);
+    return 0;
+}
+
+/**
+ * @brief 持有 stripe 的写锁时调用：把这个 stripe 接下来的 HM_MIGRATE 个旧桶搬到新表里
+ *
+ * 返回 1：这个 stripe 搬完了，而且是最后一个，调用者放锁以后要 hm_finish
+ */
+static int hm_migrate(hashmap_t* map, hm_stripe_t* stripe)
+{
+    unsigned long s = stripe - map->stripe;
+    unsigned long total = map->old_size / map->stripes; // 每个 stripe 的旧桶数
+
+    if (map->old == NULL || stripe->cursor >= total) {
+        return 0;
+    }
+
+    for (int i = 0; i < HM_MIGRATE && stripe->cursor < total; i++) {
+        unsigned long ob = s + stripe->cursor * map->stripes;
+        hm_node_t* node = map->old[ob];
+        while (node != NULL) {
+            hm_node_t* next = node->next;
+            hm_node_t** bucket = &map->buckets[hm_hash(node->key) & (map->size - 1)];
+            node->next = *bucket;
+            *bucket = node;
+            node = next;
+        }
+        map->old[ob] = NULL;
+        stripe->cursor++;
+    }
+
+    if (stripe->cursor < total) {
+        return 0;
+    }
+    return __atomic_sub_fetch(&map->migrating, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+/**
+ * @brief 上一次扩容还没搬完又要扩容：一个个 stripe 拿写锁，把剩下的旧桶都搬掉
+ *
+ * 只在写操作里顺便搬的话，一直没人写的 stripe 永远搬不完，旧表释放不了，也就再也扩不了容
+ */
+static int hm_drain(hashmap_t* map)
+{
+    int status, finish = 0;
+
+    for (unsigned long i = 0; i < map->stripes; i++) {
+        hm_stripe_t* stripe = &map->stripe[i];
+        status = rwl_writelock(&stripe->lock);
+        if (status != 0) {
+            return status;
+        }
+        while (map->old != NULL && stripe->cursor < map->old_size / map->stripes) {
+            finish |= hm_migrate(map, stripe);
+        }
+        rwl_writeunlock(&stripe->lock);
+    }
+
+    if (finish) {
+        return hm_finish(map);
+    }
+    return 0;
+}
+
+int hm_insert(hashmap_t* map, unsigned long key, void* value)
+{
+    int status, finish;
+
+    if (map->valid != HASHMAP_VALID) {
+        return EINVAL;
+    }
+
+    hm_node_t* item = (hm_node_t*)malloc(sizeof(hm_node_t));
+    if (item == NULL) {
+        return ENOMEM;
+    }
+    item->key = key;
+    item->value = value;
+
+    unsigned long hash = hm_hash(key);
+    hm_stripe_t* stripe = hm_stripe(map, hash);
+
+    status = rwl_writelock(&stripe->lock);
+    if (status != 0) {
+        free(item);
+        return status;
+    }
+    /* 上锁 */
+    finish = hm_migrate(map, stripe);
+
+    hm_node_t** bucket = hm_bucket(map, hash);
+    for (hm_node_t* node = *bucket; node != NULL; node = node->next) {
+        if (node->key == key) {
+            status = EEXIST;
+            break;
+        }
+    }
+    if (status == 0) {
+        item->next = *bucket;
+        *bucket = item;
+        __atomic_store_n(&stripe->count, stripe->count + 1, __ATOMIC_RELAXED); // hm_count 不拿锁读
+    }
+
+    /* 按这个 stripe 的元素数估计整张表的负载 */
+    unsigned long size = map->size;
+    int grow = (unsigned long)stripe->count * map->stripes > size * HM_LOAD;
+    int drain = grow && map->old != NULL;
+    /* 解锁 */
+    rwl_writeunlock(&stripe->lock);
+
+    if (status != 0) {
+        free(item);
+    }
+    if (finish) {
+        hm_finish(map);
+    }
+    if (drain) {
+        hm_drain(map);
+    }
+    if (grow) {
+        hm_grow(map, size); // 失败了也没关系，只是桶会长一些，下次插入再试
+    }
+    return status;
+}
+
+int hm_erase(hashmap_t* map, unsigned long key, void** value)
+{
+    int status, finish;
+
+    if (map->valid != HASHMAP_VALID) {
+        return EINVAL;
+    }
+
+    unsigned long hash = hm_hash(key);
+    hm_stripe_t* stripe = hm_stripe(map, hash);
+    hm_node_t* item = NULL;
+
+    status = rwl_writelock(&stripe->lock);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    finish = hm_migrate(map, stripe);
+
+    for (hm_node_t** prev = hm_bucket(map, hash); *prev != NULL; prev = &(*prev)->next) {
+        if ((*prev)->key == key) {
+            item = *prev;
+            *prev = item->next;
+            __atomic_store_n(&stripe->count, stripe->count - 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    /* 解锁 */
+    rwl_writeunlock(&stripe->lock);
+
+    if (finish) {
+        hm_finish(map);
+    }
+    if (item == NULL) {
+        return ENOENT;
+    }
+    if (value != NULL) {
+        *value = item->value;
+    }
+    free(item);
+    return 0;
+}
+
+/**
+ * @brief 各个 stripe 的计数加起来；和写操作并发的时候只是个近似值
+ *
+ */
+long hm_count(hashmap_t* map)
+{
+    long count = 0;
+
+    for (unsigned long i = 0; i < map->stripes; i++) {
+        count += __atomic_load_n(&map->stripe[i].count, __ATOMIC_RELAXED);
+    }
+    return count;
+}
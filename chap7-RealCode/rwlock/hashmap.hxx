@@ -0,0 +1,66 @@
+#ifndef __HASHMAP_HXX__
+#define __HASHMAP_HXX__
+
+#include <pthread.h>
+
+#include "rwlock.hxx"
+
+/**
+ * 分段加锁的哈希表：key 按哈希值的低位分到 stripes 个 rwlock_t 上（2 的幂，每个占一个 cache line），
+ * 不同 stripe 上的读写互不影响。stripes 是 1 的时候就是 一把全局锁 的表
+ *
+ * 桶的个数也是 2 的幂，并且不小于 stripes，所以 桶 b 属于 stripe (b & (stripes - 1))；
+ * 扩容的时候桶数翻倍，桶 b 拆成 b 和 b + size，两个新桶还属于同一个 stripe。所以：
+ *   - 开始扩容：把所有 stripe 的写锁都拿一遍，分配新表，换一下指针（不搬数据，很快）；
+ *   - 搬数据：之后每次 insert / erase 在持有自己 stripe 写锁的时候，顺便搬 HM_MIGRATE 个 这个 stripe 的旧桶；
+ *     还没搬的旧桶照样能查、能改，find 根据 stripe 的搬迁进度决定去旧表还是新表找；
+ *   - 结束：最后一个 stripe 搬完的线程再把所有写锁拿一遍，释放旧表；
+ *     上一次还没搬完又要扩容的时候（有的 stripe 一直没人写），插入的线程挨个 stripe 把剩下的搬完
+ * 除了开始、结束换指针那一下，扩容不会挡住任何人
+ */
+#define HM_LOAD 2 // 平均每个桶超过这么多个元素就扩容
+#define HM_MIGRATE 2 // 每次写操作顺便搬几个旧桶
+
+typedef struct hm_node_tag {
+    struct hm_node_tag* next;
+    unsigned long key;
+    void* value;
+} hm_node_t;
+
+typedef struct hm_stripe_tag {
+    alignas(64) rwlock_t lock;
+    long count; // 这个 stripe 里的元素个数
+    unsigned long cursor; // 扩容的时候：这个 stripe 已经搬完了几个旧桶（旧桶 stripe + i * stripes，i < cursor）
+} hm_stripe_t;
+
+typedef struct hashmap_tag {
+    pthread_mutex_t resize; // 开始 / 结束扩容的线程之间互斥，拿着它再按顺序拿所有 stripe 的写锁
+    int valid;
+    unsigned long stripes;
+    hm_stripe_t* stripe;
+    /* 下面几个只有在持有所有 stripe 写锁的时候才会改，持有任何一个 stripe 的锁都可以读 */
+    hm_node_t** buckets;
+    unsigned long size;
+    hm_node_t** old; // 正在扩容的时候是旧表，否则是 NULL
+    unsigned long old_size;
+    unsigned long migrating; // 扩容的时候：还没搬完的 stripe 数
+} hashmap_t;
+
+#define HASHMAP_VALID 0x4afacade
+
+extern int hm_init(hashmap_t* map, int stripes, unsigned long size);
+
+extern int hm_destroy(hashmap_t* map);
+
+/* 找不到返回 ENOENT */
+extern int hm_find(hashmap_t* map, unsigned long key, void** value);
+
+/* 已经有了返回 EEXIST，不覆盖 */
+extern int hm_insert(hashmap_t* map, unsigned long key, void* value);
+
+/* 找不到返回 ENOENT；value 可以是 NULL */
+extern int hm_erase(hashmap_t* map, unsigned long key, void** value);
+
+extern long hm_count(hashmap_t* map);
+
+#endif
@@ -0,0 +1,128 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "hashmap.hxx"
+
+/**
+ * 分段锁 和 一把全局锁（stripes = 1）的哈希表比一比：
+ * 先往表里放 KEYS / 2 个 key（从很小的表开始，中间会扩容好几次），
+ * 然后每个线程在 [0, KEYS) 里随机挑 key，FIND_PERCENT% 查找，剩下的一半插入、一半删除
+ *
+ * usage: rw_hashmap [stripes] [seconds]
+ */
+
+#define KEYS (1 << 20)
+#define FIND_PERCENT 90
+
+typedef struct worker_tag {
+    alignas(64) pthread_t thread_id;
+    hashmap_t* map;
+    unsigned int seed;
+    long ops;
+} worker_t;
+
+static const int thread_counts[] = { 8, 16, 32 };
+static int stop;
+
+static void* worker_routine(void* arg)
+{
+    int status;
+    worker_t* self = (worker_t*)arg;
+    void* value;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        unsigned long key = rand_r(&self->seed) % KEYS;
+        int op = rand_r(&self->seed) % 100;
+
+        if (op < FIND_PERCENT) {
+            status = hm_find(self->map, key, &value);
+            if (status != 0 && status != ENOENT) {
+                err_abort(status, "find");
+            }
+        } else if (op < FIND_PERCENT + (100 - FIND_PERCENT) / 2) {
+            status = hm_insert(self->map, key, (void*)key);
+            if (status != 0 && status != EEXIST) {
+                err_abort(status, "insert");
+            }
+        } else {
+            status = hm_erase(self->map, key, NULL);
+            if (status != 0 && status != ENOENT) {
+                err_abort(status, "erase");
+            }
+        }
+        self->ops++;
+    }
+
+    return NULL;
+}
+
+static double run(int stripes, int threads, int seconds)
+{
+    int status;
+    hashmap_t map;
+    std::vector<worker_t> workers(threads);
+
+    status = hm_init(&map, stripes, 16);
+    HANDLE_STATUS("init hashmap");
+    for (unsigned long key = 0; key < KEYS; key += 2) {
+        status = hm_insert(&map, key, (void*)key);
+        HANDLE_STATUS("fill hashmap");
+    }
+
+    stop = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].map = &map;
+        workers[i].seed = i + 1;
+        workers[i].ops = 0;
+        status = pthread_create(&workers[i].thread_id, NULL, worker_routine, &workers[i]);
+        HANDLE_STATUS("create thread");
+    }
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long ops = 0;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(workers[i].thread_id, NULL);
+        HANDLE_STATUS("join thread");
+        ops += workers[i].ops;
+    }
+
+    status = hm_destroy(&map);
+    HANDLE_STATUS("destroy hashmap");
+
+    return (double)ops / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    int stripes = 64;
+    int seconds = 2;
+
+    if (argc > 1) {
+        stripes = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    if (stripes <= 0 || (stripes & (stripes - 1)) != 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [stripes (power of 2)] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("%d keys, %d%% find, %d s per run\n", KEYS, FIND_PERCENT, seconds);
+    printf("%8s %14s %14s %8s\n", "threads", "1 lock ops/s", "striped ops/s", "ratio");
+
+    for (int threads : thread_counts) {
+        double single = run(1, threads, seconds);
+        double striped = run(stripes, threads, seconds);
+        printf("%8d %14.0f %14.0f %8.2f\n", threads, single, striped, striped / single);
+    }
+
+    return 0;
+}
@@ -0,0 +1,346 @@
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+
+#include "errors.hxx"
+#include "rcu.hxx"
+#include "spin.hxx"
+
+/**
+ * 读者：先把 全局 epoch 写到自己的 reader->epoch，再读指针；
+ * 回收线程：先把全局 epoch 加一（之前旧版本已经被换下来了），再看所有读者的 epoch。
+ * 两边中间都是 SEQ_CST 的 fence，所以至少有一方能看到另一方：要么回收线程看到读者还在旧 epoch 里、等它，
+ * 要么读者读指针的时候已经能看到新版本，拿不到要被回收的旧版本
+ */
+void rcu_read_lock(rcu_t* rcu, rcu_reader_t* reader)
+{
+    if (reader->nesting++ > 0) {
+        return;
+    }
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&rcu->epoch, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void rcu_read_unlock(rcu_t* rcu, rcu_reader_t* reader)
+{
+    (void)rcu;
+    if (--reader->nesting > 0) {
+        return;
+    }
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE); // 临界区里的读都在这之前完成
+}
+
+int rcu_register(rcu_t* rcu, rcu_reader_t* reader)
+{
+    int status;
+
+    if (rcu->valid != RCU_VALID) {
+        return EINVAL;
+    }
+
+    reader->epoch = 0;
+    reader->nesting = 0;
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    reader->next = rcu->readers;
+    rcu->readers = reader;
+    /* 解锁 */
+    return pthread_mutex_unlock(&rcu->mutex);
+}
+
+int rcu_unregister(rcu_t* rcu, rcu_reader_t* reader)
+{
+    int status;
+
+    if (rcu->valid != RCU_VALID) {
+        return EINVAL;
+    }
+    if (reader->nesting > 0) {
+        return EBUSY; // 还在临界区里
+    }
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    rcu_reader_t** prev = &rcu->readers;
+    while (*prev != NULL && *prev != reader) {
+        prev = &(*prev)->next;
+    }
+    if (*prev == NULL) {
+        pthread_mutex_unlock(&rcu->mutex);
+        return EINVAL;
+    }
+    *prev = reader->next;
+    /* 解锁 */
+    return pthread_mutex_unlock(&rcu->mutex);
+}
+
+/**
+ * @brief 宽限期：开始一个新的 epoch，等所有 在这之前进入临界区 的读者离开
+ *
+ * 调用的时候持有 mutex（读者链表不会变）。读者离开的时候不会通知我们，所以是轮询：
+ * 先自旋一会儿（临界区一般很短），然后每次让出 cpu 之前把 mutex 放掉，让注册、retire 能继续
+ */
+static int rcu_grace(rcu_t* rcu)
+{
+    int status;
+    int spins = spin_limit();
+
+    unsigned long epoch = __atomic_add_fetch(&rcu->epoch, 1, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    for (int spin = 0;; spin++) {
+        int waiting = 0;
+        for (rcu_reader_t* reader = rcu->readers; reader != NULL; reader = reader->next) {
+            unsigned long e = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+            if (e != 0 && e < epoch) {
+                waiting = 1;
+                break;
+            }
+        }
+        if (!waiting) {
+            return 0;
+        }
+
+        if (spin < spins) {
+            cpu_relax();
+            continue;
+        }
+        status = pthread_mutex_unlock(&rcu->mutex);
+        if (status != 0) {
+            return status;
+        }
+        sched_yield();
+        status = pthread_mutex_lock(&rcu->mutex);
+        if (status != 0) {
+            return status;
+        }
+    }
+}
+
+/**
+ * @brief 持有 mutex 时调用：拿走目前所有的旧版本，过一个宽限期，然后（不持有 mutex）释放它们
+ *
+ */
+static int rcu_reclaim(rcu_t* rcu)
+{
+    int status;
+
+    rcu_retired_t* batch = rcu->retired;
+    rcu->retired = NULL;
+
+    status = rcu_grace(rcu);
+    if (status != 0) {
+        /* 宽限期没过完，这一批还不能释放：放回 retired 的最前面，下次再回收，免得漏掉 */
+        if (batch != NULL) {
+            rcu_retired_t* last = batch;
+            while (last->next != NULL) {
+                last = last->next;
+            }
+            last->next = rcu->retired;
+            rcu->retired = batch;
+        }
+        return status;
+    }
+
+    status = pthread_mutex_unlock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+    while (batch != NULL) {
+        rcu_retired_t* next = batch->next;
+        batch->free_fn(batch->ptr);
+        free(batch);
+        batch = next;
+    }
+    return pthread_mutex_lock(&rcu->mutex);
+}
+
+static void* rcu_reclaimer(void* arg)
+{
+    int status;
+    rcu_t* rcu = (rcu_t*)arg;
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        err_abort(status, "lock rcu");
+    }
+    /* 上锁 */
+    while (1) {
+        while (rcu->retired == NULL && !rcu->quit) {
+            status = pthread_cond_wait(&rcu->cv, &rcu->mutex);
+            if (status != 0) {
+                err_abort(status, "wait rcu");
+            }
+        }
+        if (rcu->quit) {
+            break; // 剩下的由 rcu_destroy 回收
+        }
+
+        /* 攒一批：RCU_INTERVAL 内 retire 的旧版本共用一个宽限期 */
+        struct timespec timeout;
+        clock_gettime(CLOCK_REALTIME, &timeout);
+        timeout.tv_nsec += RCU_INTERVAL * 1000000L;
+        if (timeout.tv_nsec >= 1000000000L) {
+            timeout.tv_sec++;
+            timeout.tv_nsec -= 1000000000L;
+        }
+        while (!rcu->quit) {
+            status = pthread_cond_timedwait(&rcu->cv, &rcu->mutex, &timeout);
+            if (status == ETIMEDOUT) {
+                break;
+            } else if (status != 0) {
+                err_abort(status, "wait rcu");
+            }
+        }
+
+        status = rcu_reclaim(rcu);
+        if (status != 0) {
+            err_abort(status, "reclaim rcu");
+        }
+    }
+    /* 解锁 */
+    pthread_mutex_unlock(&rcu->mutex);
+    return NULL;
+}
+
+int rcu_init(rcu_t* rcu)
+{
+    int status;
+
+    rcu->epoch = 1;
+    rcu->readers = NULL;
+    rcu->retired = NULL;
+    rcu->quit = 0;
+
+    status = pthread_mutex_init(&rcu->mutex, NULL);
+    if (status != 0) {
+        return status;
+    }
+
+    status = pthread_cond_init(&rcu->cv, NULL);
+    if (status != 0) {
+        pthread_mutex_destroy(&rcu->mutex);
+        return status;
+    }
+
+    status = pthread_create(&rcu->reclaimer, NULL, rcu_reclaimer, (void*)rcu);
+    if (status != 0) {
+        pthread_cond_destroy(&rcu->cv);
+        pthread_mutex_destroy(&rcu->mutex);
+        return status;
+    }
+
+    rcu->valid = RCU_VALID;
+
+    return 0;
+}
+
+/**
+ * @brief 停掉回收线程，把还没回收的旧版本都释放掉。所有读者必须已经 rcu_unregister
+ *
+ */
+int rcu_destroy(rcu_t* rcu)
+{
+    int status, status1, status2;
+
+    if (rcu->valid != RCU_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    if (rcu->readers != NULL) {
+        pthread_mutex_unlock(&rcu->mutex);
+        return EBUSY;
+    }
+    rcu->valid = 0;
+    rcu->quit = 1;
+    status = pthread_cond_signal(&rcu->cv);
+    if (status != 0) {
+        pthread_mutex_unlock(&rcu->mutex);
+        return status;
+    }
+    /* 解锁 */
+    status = pthread_mutex_unlock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    status = pthread_join(rcu->reclaimer, NULL);
+    if (status != 0) {
+        return status;
+    }
+
+    /* 没有读者了，不用等宽限期 */
+    while (rcu->retired != NULL) {
+        rcu_retired_t* next = rcu->retired->next;
+        rcu->retired->free_fn(rcu->retired->ptr);
+        free(rcu->retired);
+        rcu->retired = next;
+    }
+
+    status1 = pthread_mutex_destroy(&rcu->mutex);
+    status2 = pthread_cond_destroy(&rcu->cv);
+    return (status1 != 0 ? status1 : status2);
+}
+
+int rcu_retire(rcu_t* rcu, void* ptr, void (*free_fn)(void*))
+{
+    int status;
+
+    if (rcu->valid != RCU_VALID) {
+        return EINVAL;
+    }
+
+    rcu_retired_t* item = (rcu_retired_t*)malloc(sizeof(rcu_retired_t));
+    if (item == NULL) {
+        return ENOMEM;
+    }
+    item->ptr = ptr;
+    item->free_fn = free_fn;
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        free(item);
+        return status;
+    }
+    /* 上锁 */
+    item->next = rcu->retired;
+    if (rcu->retired == NULL) {
+        status = pthread_cond_signal(&rcu->cv); // 回收线程只在空的时候睡
+    }
+    rcu->retired = item;
+    /* 解锁 */
+    pthread_mutex_unlock(&rcu->mutex);
+    return status;
+}
+
+int rcu_synchronize(rcu_t* rcu)
+{
+    int status, status1;
+
+    if (rcu->valid != RCU_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_lock(&rcu->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    status = rcu_grace(rcu);
+    /* 解锁 */
+    status1 = pthread_mutex_unlock(&rcu->mutex);
+    return (status != 0 ? status : status1);
+}
@@ -0,0 +1,73 @@
+#ifndef __RCU_HXX__
+#define __RCU_HXX__
+
+#include <pthread.h>
+
+/**
+ * 基于 epoch 的 RCU：给 很大的、读非常多的、整个换掉来发布的 数据用（路由表、配置）
+ *
+ * 读者：rcu_read_lock / rcu_read_unlock 之间用 rcu_dereference 拿到的指针一直有效。
+ *       进出临界区只是写一下自己的 rcu_reader_t，不碰任何锁，也不会被写者挡住
+ * 写者：造好新的版本，rcu_assign_pointer 发布出去，再把旧的交给 rcu_retire。
+ *       写者之间要自己互斥（比如 rwlock_t 的写锁，或者一个 mutex）
+ * 回收：后台线程每隔 RCU_INTERVAL 毫秒把攒下的旧版本拿走，把全局 epoch 加一，
+ *       等所有 在旧 epoch 里进入临界区 的读者离开（宽限期），然后调用 free 函数。
+ *       这之后不可能还有读者拿着旧指针：比它们晚进来的读者，已经看不到旧版本了
+ *
+ * 每个读者线程先 rcu_register 一个自己的 rcu_reader_t，退出前 rcu_unregister。
+ * 临界区可以嵌套，但不能在里面睡很久：回收线程会一直等它
+ */
+#define RCU_INTERVAL 10 // ms，攒一批再回收，摊掉宽限期的开销
+
+typedef struct rcu_reader_tag {
+    alignas(64) unsigned long epoch; // 0：不在临界区；否则是进来时的全局 epoch
+    int nesting;
+    struct rcu_reader_tag* next;
+} rcu_reader_t;
+
+typedef struct rcu_retired_tag {
+    struct rcu_retired_tag* next;
+    void* ptr;
+    void (*free_fn)(void*);
+} rcu_retired_t;
+
+typedef struct rcu_tag {
+    pthread_mutex_t mutex; // 保护 readers、retired 和 quit
+    pthread_cond_t cv; // 有东西要回收，或者要退出了
+    int valid;
+    unsigned long epoch; // 从 1 开始，只有宽限期开始的时候加一
+    rcu_reader_t* readers;
+    rcu_retired_t* retired;
+    int quit;
+    pthread_t reclaimer;
+} rcu_t;
+
+#define RCU_VALID 0xacade
+
+extern int rcu_init(rcu_t* rcu);
+
+extern int rcu_destroy(rcu_t* rcu);
+
+extern int rcu_register(rcu_t* rcu, rcu_reader_t* reader);
+
+extern int rcu_unregister(rcu_t* rcu, rcu_reader_t* reader);
+
+extern void rcu_read_lock(rcu_t* rcu, rcu_reader_t* reader);
+
+extern void rcu_read_unlock(rcu_t* rcu, rcu_reader_t* reader);
+
+/**
+ * 旧版本已经不可见了（新的已经发布），等宽限期过了由后台线程调用 free_fn(ptr)
+ */
+extern int rcu_retire(rcu_t* rcu, void* ptr, void (*free_fn)(void*));
+
+/**
+ * 同步地等一个宽限期：返回的时候，调用之前就在临界区里的读者都已经离开了。不能在临界区里调用
+ */
+extern int rcu_synchronize(rcu_t* rcu);
+
+/* 读者读 被发布的指针；写者发布新的指针 */
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+#endif
@@ -0,0 +1,236 @@
+#include <cstdio>
+#include <cstdlib>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "rcu.hxx"
+
+/**
+ * rcu_t 的检查：
+ *   grace：一个读者进了临界区以后睡 GRACE_HOLD ms，这期间 rcu_synchronize 不能返回；
+ *          它 retire 的旧版本也不能被释放
+ *   reclaim：readers 个读者不停地在临界区里检查整张表（values[i] == version + i），
+ *          一个写者换 tables 次表，旧表交给 rcu_retire。free 函数先把表涂成 -1 再释放，
+ *          所以 宽限期没等够、读者还拿着就释放了 会被读者看到（bad）。最后所有旧表都要被释放
+ *
+ * usage: rw_rcu [readers] [tables]
+ */
+
+#define TABLE_SIZE 64
+#define GRACE_HOLD 100 // ms
+
+typedef struct table_tag {
+    long version;
+    long values[TABLE_SIZE];
+} table_t;
+
+typedef struct reader_tag {
+    alignas(64) pthread_t thread_id;
+    rcu_reader_t rcu_reader;
+    long reads;
+    long bad;
+} reader_t;
+
+static rcu_t rcu;
+static table_t* table;
+static long freed;
+static int stop;
+static int entered;
+static int left;
+
+static table_t* table_new(long version)
+{
+    table_t* t = (table_t*)malloc(sizeof(table_t));
+    if (t == NULL) {
+        errno_abort("allocate table");
+    }
+    t->version = version;
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        t->values[i] = version + i;
+    }
+    return t;
+}
+
+static void table_free(void* arg)
+{
+    table_t* t = (table_t*)arg;
+
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        __atomic_store_n(&t->values[i], -1L, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&t->version, -1L, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&freed, 1, __ATOMIC_RELAXED);
+    free(t);
+}
+
+static void* reader_routine(void* arg)
+{
+    int status;
+    reader_t* self = (reader_t*)arg;
+
+    status = rcu_register(&rcu, &self->rcu_reader);
+    HANDLE_STATUS("register reader");
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        rcu_read_lock(&rcu, &self->rcu_reader);
+        table_t* t = rcu_dereference(table);
+        long version = __atomic_load_n(&t->version, __ATOMIC_RELAXED);
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            if (__atomic_load_n(&t->values[i], __ATOMIC_RELAXED) != version + i) {
+                self->bad++;
+                break;
+            }
+        }
+        rcu_read_unlock(&rcu, &self->rcu_reader);
+        self->reads++;
+    }
+
+    status = rcu_unregister(&rcu, &self->rcu_reader);
+    HANDLE_STATUS("unregister reader");
+    return NULL;
+}
+
+/* 在临界区里待 GRACE_HOLD ms */
+static void* holder_routine(void* arg)
+{
+    int status;
+    rcu_reader_t* reader = (rcu_reader_t*)arg;
+
+    status = rcu_register(&rcu, reader);
+    HANDLE_STATUS("register holder");
+    rcu_read_lock(&rcu, reader);
+    __atomic_store_n(&entered, 1, __ATOMIC_RELEASE);
+    usleep(GRACE_HOLD * 1000);
+    __atomic_store_n(&left, 1, __ATOMIC_RELEASE);
+    rcu_read_unlock(&rcu, reader);
+    status = rcu_unregister(&rcu, reader);
+    HANDLE_STATUS("unregister holder");
+    return NULL;
+}
+
+static int check_grace(void)
+{
+    int status;
+    pthread_t holder_id;
+    rcu_reader_t reader;
+    int failed = 0;
+
+    entered = 0;
+    left = 0;
+    __atomic_store_n(&freed, 0, __ATOMIC_RELAXED);
+    status = pthread_create(&holder_id, NULL, holder_routine, &reader);
+    HANDLE_STATUS("create holder");
+    while (!__atomic_load_n(&entered, __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    /* 回收线程等了好几个 RCU_INTERVAL 也不能释放 */
+    status = rcu_retire(&rcu, table_new(0), table_free);
+    HANDLE_STATUS("retire table");
+    usleep(GRACE_HOLD * 1000 / 2);
+    if (!__atomic_load_n(&left, __ATOMIC_ACQUIRE) && __atomic_load_n(&freed, __ATOMIC_RELAXED) != 0) {
+        printf("grace: retired table freed while a reader was inside\n");
+        failed = 1;
+    }
+
+    status = rcu_synchronize(&rcu);
+    HANDLE_STATUS("synchronize");
+    if (!__atomic_load_n(&left, __ATOMIC_ACQUIRE)) {
+        printf("grace: rcu_synchronize returned while a reader was inside\n");
+        failed = 1;
+    }
+
+    status = pthread_join(holder_id, NULL);
+    HANDLE_STATUS("join holder");
+
+    /* 读者走了以后要能回收掉 */
+    for (int i = 0; i < 100 && __atomic_load_n(&freed, __ATOMIC_RELAXED) == 0; i++) {
+        usleep(RCU_INTERVAL * 1000);
+    }
+    if (__atomic_load_n(&freed, __ATOMIC_RELAXED) != 1) {
+        printf("grace: retired table not freed after the reader left\n");
+        failed = 1;
+    }
+    return failed;
+}
+
+static int check_reclaim(int threads, long tables)
+{
+    int status;
+    std::vector<reader_t> readers(threads);
+
+    stop = 0;
+    __atomic_store_n(&freed, 0, __ATOMIC_RELAXED);
+    table = table_new(1);
+
+    for (int i = 0; i < threads; i++) {
+        readers[i].reads = 0;
+        readers[i].bad = 0;
+        status = pthread_create(&readers[i].thread_id, NULL, reader_routine, &readers[i]);
+        HANDLE_STATUS("create reader");
+    }
+
+    /* 只有这一个写者，不用再互斥 */
+    for (long version = 2; version < tables + 2; version++) {
+        table_t* old = table;
+        rcu_assign_pointer(table, table_new(version));
+        status = rcu_retire(&rcu, old, table_free);
+        HANDLE_STATUS("retire table");
+    }
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+    long reads = 0, bad = 0;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(readers[i].thread_id, NULL);
+        HANDLE_STATUS("join reader");
+        reads += readers[i].reads;
+        bad += readers[i].bad;
+    }
+
+    status = rcu_synchronize(&rcu);
+    HANDLE_STATUS("synchronize");
+    free(table); // 最后一张没有 retire，不算在 freed 里
+    /* 剩下的可能还在回收线程手上，最多再等几个 RCU_INTERVAL */
+    for (int i = 0; i < 100 && __atomic_load_n(&freed, __ATOMIC_RELAXED) < tables; i++) {
+        usleep(RCU_INTERVAL * 1000);
+    }
+
+    long done = __atomic_load_n(&freed, __ATOMIC_RELAXED);
+    printf("reclaim: %d readers, %ld reads, %ld bad, %ld/%ld tables freed\n", threads, reads, bad, done, tables);
+    return bad != 0 || done != tables;
+}
+
+int main(int argc, char* argv[])
+{
+    int status;
+    int threads = 4;
+    long tables = 200000;
+
+    if (argc > 1) {
+        threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        tables = atol(argv[2]);
+    }
+    if (threads <= 0 || tables <= 0) {
+        fprintf(stderr, "usage: %s [readers] [tables]\n", argv[0]);
+        return 1;
+    }
+
+    status = rcu_init(&rcu);
+    HANDLE_STATUS("init rcu");
+
+    if (check_grace() != 0) {
+        return 1;
+    }
+    printf("grace: ok\n");
+    if (check_reclaim(threads, tables) != 0) {
+        return 1;
+    }
+
+    status = rcu_destroy(&rcu);
+    HANDLE_STATUS("destroy rcu");
+    return 0;
+}
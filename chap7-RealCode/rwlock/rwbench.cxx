@@ -0,0 +1,298 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <shared_mutex>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "rwlock.hxx"
+
+/**
+ * 读写比例扫描：rwlock_t、glibc 的 pthread_rwlock_t、std::shared_mutex
+ *
+ * 扫三个维度：线程数（1, 2, 4 ... 2 倍核数）、读的比例（50% ~ 100%）、临界区长度（空转次数）。
+ * 每个点跑固定的时间，报告 总的 ops/s，以及加锁延迟（调用 lock 到拿到锁）的 p50 / p99 / p99.9。
+ * 延迟每 SAMPLE 次操作采一次，免得 clock_gettime 本身把吞吐拖下来
+ *
+ * usage: rw_bench [max threads] [ms per point]
+ */
+
+#define SAMPLE 16
+#define OUTSIDE_WORK 100 // 两次加锁之间的空转次数，免得一个线程一直霸着锁
+
+static const int read_percents[] = { 50, 80, 95, 99, 100 };
+static const int cs_lengths[] = { 0, 100, 1000 };
+
+typedef struct bench_tag {
+    const char* name;
+    int (*init)(struct bench_tag* bench);
+    void (*readlock)(struct bench_tag* bench);
+    void (*readunlock)(struct bench_tag* bench);
+    void (*writelock)(struct bench_tag* bench);
+    void (*writeunlock)(struct bench_tag* bench);
+    void (*destroy)(struct bench_tag* bench);
+    int policy;
+    rwlock_t rwlock;
+    pthread_rwlock_t prwlock;
+    std::shared_mutex* smutex;
+} bench_t;
+
+typedef struct worker_tag {
+    alignas(64) pthread_t thread_id;
+    bench_t* bench;
+    unsigned int seed;
+    int read_percent;
+    int cs;
+    long ops;
+    std::vector<long> latency; // ns
+} worker_t;
+
+static int stop;
+static long shared_data;
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void work(int loops)
+{
+    for (int i = 0; i < loops; i++) {
+        asm volatile("" ::: "memory");
+    }
+}
+
+static int rwl_bench_init(bench_t* bench)
+{
+    return rwl_init_policy(&bench->rwlock, bench->policy);
+}
+
+static void rwl_bench_readlock(bench_t* bench)
+{
+    int status = rwl_readlock(&bench->rwlock);
+    HANDLE_STATUS("read lock");
+}
+
+static void rwl_bench_readunlock(bench_t* bench)
+{
+    int status = rwl_readunlock(&bench->rwlock);
+    HANDLE_STATUS("read unlock");
+}
+
+static void rwl_bench_writelock(bench_t* bench)
+{
+    int status = rwl_writelock(&bench->rwlock);
+    HANDLE_STATUS("write lock");
+}
+
+static void rwl_bench_writeunlock(bench_t* bench)
+{
+    int status = rwl_writeunlock(&bench->rwlock);
+    HANDLE_STATUS("write unlock");
+}
+
+static void rwl_bench_destroy(bench_t* bench)
+{
+    rwl_destroy(&bench->rwlock);
+}
+
+static int pthread_bench_init(bench_t* bench)
+{
+    return pthread_rwlock_init(&bench->prwlock, NULL);
+}
+
+static void pthread_bench_readlock(bench_t* bench)
+{
+    int status = pthread_rwlock_rdlock(&bench->prwlock);
+    HANDLE_STATUS("pthread read lock");
+}
+
+static void pthread_bench_writelock(bench_t* bench)
+{
+    int status = pthread_rwlock_wrlock(&bench->prwlock);
+    HANDLE_STATUS("pthread write lock");
+}
+
+static void pthread_bench_unlock(bench_t* bench)
+{
+    int status = pthread_rwlock_unlock(&bench->prwlock);
+    HANDLE_STATUS("pthread unlock");
+}
+
+static void pthread_bench_destroy(bench_t* bench)
+{
+    pthread_rwlock_destroy(&bench->prwlock);
+}
+
+static int std_bench_init(bench_t* bench)
+{
+    bench->smutex = new std::shared_mutex;
+    return 0;
+}
+
+static void std_bench_readlock(bench_t* bench)
+{
+    bench->smutex->lock_shared();
+}
+
+static void std_bench_readunlock(bench_t* bench)
+{
+    bench->smutex->unlock_shared();
+}
+
+static void std_bench_writelock(bench_t* bench)
+{
+    bench->smutex->lock();
+}
+
+static void std_bench_writeunlock(bench_t* bench)
+{
+    bench->smutex->unlock();
+}
+
+static void std_bench_destroy(bench_t* bench)
+{
+    delete bench->smutex;
+}
+
+static bench_t benches[] = {
+    { "rwlock_t", rwl_bench_init, rwl_bench_readlock, rwl_bench_readunlock,
+        rwl_bench_writelock, rwl_bench_writeunlock, rwl_bench_destroy, RWL_PREFER_READER },
+    { "rwlock_t(fair)", rwl_bench_init, rwl_bench_readlock, rwl_bench_readunlock,
+        rwl_bench_writelock, rwl_bench_writeunlock, rwl_bench_destroy, RWL_PHASE_FAIR },
+    { "pthread_rwlock_t", pthread_bench_init, pthread_bench_readlock, pthread_bench_unlock,
+        pthread_bench_writelock, pthread_bench_unlock, pthread_bench_destroy },
+    { "std::shared_mutex", std_bench_init, std_bench_readlock, std_bench_readunlock,
+        std_bench_writelock, std_bench_writeunlock, std_bench_destroy },
+};
+
+static void* worker_routine(void* arg)
+{
+    worker_t* self = (worker_t*)arg;
+    bench_t* bench = self->bench;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        int write = (int)(rand_r(&self->seed) % 100) >= self->read_percent;
+        int sample = self->ops % SAMPLE == 0;
+        long start = sample ? now_ns() : 0;
+
+        if (write) {
+            bench->writelock(bench);
+        } else {
+            bench->readlock(bench);
+        }
+        if (sample) {
+            self->latency.push_back(now_ns() - start);
+        }
+
+        if (write) {
+            shared_data++;
+            work(self->cs);
+            bench->writeunlock(bench);
+        } else {
+            work(self->cs);
+            bench->readunlock(bench);
+        }
+        self->ops++;
+        work(OUTSIDE_WORK);
+    }
+
+    return NULL;
+}
+
+static long percentile(std::vector<long>& v, double p)
+{
+    if (v.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + index, v.end());
+    return v[index];
+}
+
+static void run(bench_t* bench, int threads, int read_percent, int cs, int ms)
+{
+    int status;
+    std::vector<worker_t> workers(threads);
+
+    status = bench->init(bench);
+    HANDLE_STATUS("init lock");
+    stop = 0;
+
+    for (int i = 0; i < threads; i++) {
+        workers[i].bench = bench;
+        workers[i].seed = i + 1;
+        workers[i].read_percent = read_percent;
+        workers[i].cs = cs;
+        workers[i].ops = 0;
+        workers[i].latency.reserve(1 << 16);
+    }
+
+    long start = now_ns();
+    for (int i = 0; i < threads; i++) {
+        status = pthread_create(&workers[i].thread_id, NULL, worker_routine, &workers[i]);
+        HANDLE_STATUS("create thread");
+    }
+    usleep(ms * 1000);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long ops = 0;
+    std::vector<long> latency;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(workers[i].thread_id, NULL);
+        HANDLE_STATUS("join thread");
+        ops += workers[i].ops;
+        latency.insert(latency.end(), workers[i].latency.begin(), workers[i].latency.end());
+    }
+    long elapsed = now_ns() - start;
+
+    printf("%-18s %3d %5d%% %5d %13.0f %9ld %9ld %10ld\n",
+        bench->name, threads, read_percent, cs, ops / (elapsed / 1e9),
+        percentile(latency, 0.50), percentile(latency, 0.99), percentile(latency, 0.999));
+
+    bench->destroy(bench);
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    int ms = 200;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        ms = atoi(argv[2]);
+    }
+    if (max_threads <= 0 || ms <= 0) {
+        fprintf(stderr, "usage: %s [max threads] [ms per point]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<int> thread_counts;
+    for (int threads = 1; threads < max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(max_threads);
+
+    printf("%-18s %3s %6s %5s %13s %9s %9s %10s\n",
+        "lock", "thr", "read", "cs", "ops/s", "lat p50", "lat p99", "lat p99.9");
+    printf("(cs in spin loops, lock latency in ns)\n");
+
+    for (int cs : cs_lengths) {
+        for (int read_percent : read_percents) {
+            for (int threads : thread_counts) {
+                for (auto& bench : benches) {
+                    run(&bench, threads, read_percent, cs, ms);
+                }
+            }
+        }
+    }
+
+    return 0;
+}
@@ -2,15 +2,31 @@
 
 #include "errors.hxx"
 #include "rwlock.hxx"
+#include "spin.hxx"
 
 int rwl_init(rwlock_t* rwl)
+{
+    return rwl_init_policy(rwl, RWL_PREFER_READER);
+}
+
+int rwl_init_policy(rwlock_t* rwl, int policy)
 {
     int status;
 
-    rwl->r_active = 0;
+    if (policy != RWL_PREFER_READER && policy != RWL_PREFER_WRITER && policy != RWL_PHASE_FAIR) {
+        return EINVAL;
+    }
+
+    rwl->policy = policy;
+    rwl->admit = 0;
+    rwl->w_gen = 0;
+    rwl->state = 0;
     rwl->r_wait = 0;
-    rwl->w_active = 0;
     rwl->w_wait = 0;
+    rwl->u_wait = 0;
+    rwl->upgrading = 0;
+    rwl->spins = 0;
+    RWL_STATS_INIT(rwl);
 
     status = pthread_mutex_init(&rwl->mutex, NULL);
     if (status != 0) {
@@ -30,6 +46,14 @@ int rwl_init(rwlock_t* rwl)
         return status;
     }
 
+    status = pthread_cond_init(&rwl->upgrade, NULL);
+    if (status != 0) {
+        pthread_cond_destroy(&rwl->write);
+        pthread_cond_destroy(&rwl->read);
+        pthread_mutex_destroy(&rwl->mutex);
+        return status;
+    }
+
     rwl->valid = RWLOCK_VALID;
 
     return 0;
@@ -48,12 +72,12 @@ int rwl_destroy(rwlock_t* rwl)
         return status;
     }
 
-    if (rwl->r_active > 0 || rwl->w_active > 0) {
+    if (__atomic_load_n(&rwl->state, __ATOMIC_ACQUIRE) & ~RWL_WAITING) {
         pthread_mutex_unlock(&rwl->mutex);
         return EBUSY;
     }
 
-    if (rwl->r_wait > 0 || rwl->w_wait > 0) {
+    if (rwl->r_wait > 0 || rwl->w_wait > 0 || rwl->u_wait > 0) {
         pthread_mutex_unlock(&rwl->mutex);
         return EBUSY;
     }
@@ -63,18 +87,139 @@ int rwl_destroy(rwlock_t* rwl)
     if (status != 0) {
         return status;
     }
+    RWL_STATS_DESTROY(rwl);
     status = pthread_mutex_destroy(&rwl->mutex);
     int status1 = pthread_cond_destroy(&rwl->read);
     int status2 = pthread_cond_destroy(&rwl->write);
+    int status3 = pthread_cond_destroy(&rwl->upgrade);
     return (status != 0 ? status
                         : (status1 != 0 ? status1
-                                        : status2));
+                                        : (status2 != 0 ? status2
+                                                        : status3)));
+}
+
+/**
+ * @brief 持有 mutex 时调用：最后一个等待者离开的时候，把 RWL_WAITING 清掉，快速路径重新生效
+ *
+ */
+static void rwl_clearwaiting(rwlock_t* rwl)
+{
+    if (rwl->r_wait == 0 && rwl->w_wait == 0 && rwl->u_wait == 0 && !rwl->upgrading) {
+        __atomic_fetch_and(&rwl->state, ~RWL_WAITING, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief 持有 mutex 时调用：锁被释放了（或者有等待者放弃了），按照策略唤醒等待者
+ *
+ */
+static int rwl_wakeup(rwlock_t* rwl)
+{
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    int readers_first;
+    int status = 0;
+
+    if (state & RWL_WRITER) {
+        return 0;
+    }
+
+    /* 正在升级的线程已经持有 RWL_UPGRADER，只等读者走光，别人都得等它 */
+    if (rwl->upgrading) {
+        if (RWL_READERS(state) == 0) {
+            return pthread_cond_broadcast(&rwl->upgrade);
+        }
+        return 0;
+    }
+
+    switch (rwl->policy) {
+    case RWL_PREFER_WRITER:
+        readers_first = rwl->w_wait == 0;
+        break;
+    case RWL_PHASE_FAIR:
+        readers_first = rwl->admit > 0 || rwl->w_wait == 0;
+        break;
+    default:
+        readers_first = 1;
+        break;
+    }
+
+    int upgraders = rwl->u_wait > 0 && !(state & RWL_UPGRADER);
+    if (readers_first && (upgraders || rwl->r_wait > 0)) {
+        if (upgraders) {
+            status = pthread_cond_broadcast(&rwl->upgrade); // 可升级读者和读者一起放行
+        }
+        if (status == 0 && rwl->r_wait > 0) {
+            status = pthread_cond_broadcast(&rwl->read);
+        }
+        return status;
+    }
+    if (RWL_READERS(state) == 0 && !(state & RWL_UPGRADER) && rwl->w_wait > 0) {
+        return pthread_cond_signal(&rwl->write);
+    }
+    return 0;
 }
 
+/**
+ * @brief 持有 mutex 时调用：state 允许读的前提下，策略是否允许这个读者进来
+ *
+ * gen 是读者开始等待时的 w_gen，变了说明之后有写者释放过，这个读者属于被放行的读阶段
+ */
+static int rwl_readable(rwlock_t* rwl, unsigned int state, unsigned int gen)
+{
+    if ((state & RWL_WRITER) || rwl->upgrading) {
+        return 0;
+    }
+
+    switch (rwl->policy) {
+    case RWL_PREFER_WRITER:
+        return rwl->w_wait == 0;
+    case RWL_PHASE_FAIR:
+        return rwl->w_wait == 0 || gen != rwl->w_gen;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief 持有 mutex 时调用：写者能不能进，state 里除了 RWL_WAITING 之外什么都不能有
+ *
+ */
+static int rwl_writable(rwlock_t* rwl, unsigned int state)
+{
+    if (state != RWL_WAITING) {
+        return 0;
+    }
+    return rwl->policy != RWL_PHASE_FAIR || rwl->admit == 0;
+}
+
+/**
+ * @brief 持有 mutex 时调用：一个写阶段结束了（写解锁或者降级）
+ *
+ */
+static void rwl_endwrite(rwlock_t* rwl)
+{
+    /* 读阶段：放行现在排队的所有读者，它们都进来之前，下一个写者不能进 */
+    if (rwl->policy == RWL_PHASE_FAIR) {
+        rwl->w_gen++;
+        rwl->admit = rwl->r_wait + rwl->u_wait;
+    }
+}
+
+typedef struct rwl_waiter_tag {
+    rwlock_t* rwl;
+    unsigned int gen;
+} rwl_waiter_t;
+
 static void rwl_readcleanup(void* arg)
 {
-    rwlock_t* rwl = (rwlock_t*)arg;
+    rwl_waiter_t* waiter = (rwl_waiter_t*)arg;
+    rwlock_t* rwl = waiter->rwl;
     rwl->r_wait--;
+    if (rwl->policy == RWL_PHASE_FAIR && waiter->gen != rwl->w_gen) {
+        rwl->admit--; // 被放行了却不进来了，不能让写者一直等它
+    }
+    rwl_wakeup(rwl);
+    rwl_clearwaiting(rwl);
     pthread_mutex_unlock(&rwl->mutex);
 }
 
@@ -82,69 +227,155 @@ static void rwl_writecleanup(void* arg)
 {
     rwlock_t* rwl = (rwlock_t*)arg;
     rwl->w_wait--;
+    rwl_wakeup(rwl); // RWL_PREFER_WRITER / RWL_PHASE_FAIR 下可能有读者在等我们
+    rwl_clearwaiting(rwl);
     pthread_mutex_unlock(&rwl->mutex);
 }
 
-int rwl_readlock(rwlock_t* rwl)
+/**
+ * 慢路径：在 mutex 里先置上 RWL_WAITING，再检查 state。
+ * 对 state 的修改是全序的：释放者的 CAS 要么发生在我们置位之前（那我们就能看到锁已经空了），
+ * 要么发生在之后（那它的 CAS 会失败，转去 mutex 里唤醒我们）。所以不会丢失唤醒
+ */
+static int rwl_readlock_slow(rwlock_t* rwl)
 {
     int status;
 
-    if (rwl->valid != RWLOCK_VALID) {
-        return EINVAL;
-    }
-
     status = pthread_mutex_lock(&rwl->mutex);
     if (status != 0) {
         return status;
     }
     /* 上锁 */
-    if (rwl->w_active) { // 如果依然有写线程的话，那么就暂停
-        rwl->r_wait++;
-        pthread_cleanup_push(rwl_readcleanup, (void*)rwl);
-        while (rwl->w_active) {
-            status = pthread_cond_wait(&rwl->read, &rwl->mutex);
-            if (status != 0) {
+    rwl_waiter_t waiter = { rwl, rwl->w_gen };
+    rwl->r_wait++;
+    pthread_cleanup_push(rwl_readcleanup, (void*)&waiter);
+    while (1) {
+        unsigned int state = __atomic_fetch_or(&rwl->state, RWL_WAITING, __ATOMIC_ACQUIRE) | RWL_WAITING;
+        if (rwl_readable(rwl, state, waiter.gen)) {
+            if (__atomic_compare_exchange_n(&rwl->state, &state, state + RWL_READER,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
                 break;
             }
+            continue; // 别的读者同时改了计数，再来一次
+        }
+        status = pthread_cond_wait(&rwl->read, &rwl->mutex);
+        if (status != 0) {
+            break;
         }
-        pthread_cleanup_pop(0); // 弹出的时候，不执行
     }
-
-    if (status == 0) {
-        rwl->r_active++; // 这个是用来控制 写线程 等待的，就像上面的 w_active 等待一样
+    pthread_cleanup_pop(0); // 弹出的时候，不执行
+    if (status == 0 && rwl->policy == RWL_PHASE_FAIR && waiter.gen != rwl->w_gen) {
+        rwl->admit--;
     }
+    rwl->r_wait--;
+    rwl_clearwaiting(rwl);
+
     /* 解锁 */
     pthread_mutex_unlock(&rwl->mutex);
-    if (status != 0) {
-        return status;
-    }
     return status;
 }
 
-int rwl_readtrylock(rwlock_t* rwl)
+/**
+ * 临界区一般很短：与其马上去 cond 上睡（一次 futex 睡眠 + 一次唤醒），不如先转几圈等持有者放手。
+ * 只在没有人排队的时候转：RWL_WAITING 已经置上，说明前面有人在睡，我们也跟着去排队，公平策略才管用
+ *
+ * 转到了返回 1；转了一圈预算也没等到返回 0，这时候圈数按预算算进估计，下一次多转一些
+ */
+static int rwl_readspin(rwlock_t* rwl)
 {
-    int status1, status2;
+    int budget = spin_budget(&rwl->spins);
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
 
+    for (int spin = 0; spin < budget; spin++) {
+        if (state & RWL_WAITING) {
+            return 0;
+        }
+        if (!(state & RWL_WRITER)) {
+            if (__atomic_compare_exchange_n(&rwl->state, &state, state + RWL_READER,
+                    true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                spin_update(&rwl->spins, spin);
+                return 1;
+            }
+            continue;
+        }
+        cpu_relax();
+        state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    }
+
+    if (budget > 0) {
+        spin_update(&rwl->spins, budget);
+    }
+    return 0;
+}
+
+static int rwl_writespin(rwlock_t* rwl)
+{
+    int budget = spin_budget(&rwl->spins);
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+
+    for (int spin = 0; spin < budget; spin++) {
+        if (state & RWL_WAITING) {
+            return 0;
+        }
+        if (state == 0) {
+            if (__atomic_compare_exchange_n(&rwl->state, &state, RWL_WRITER,
+                    true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                spin_update(&rwl->spins, spin);
+                return 1;
+            }
+            continue;
+        }
+        cpu_relax();
+        state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    }
+
+    if (budget > 0) {
+        spin_update(&rwl->spins, budget);
+    }
+    return 0;
+}
+
+int rwl_readlock(rwlock_t* rwl)
+{
     if (rwl->valid != RWLOCK_VALID) {
         return EINVAL;
     }
 
-    status1 = pthread_mutex_lock(&rwl->mutex);
-    if (status1 != 0) {
-        return status1;
+    /* 快速路径：没有写者、也没有人在排队，CAS 一下读者计数就好 */
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    while (!(state & (RWL_WRITER | RWL_WAITING))) {
+        if (__atomic_compare_exchange_n(&rwl->state, &state, state + RWL_READER,
+                true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, 0L);
+            return 0;
+        }
     }
-    /* 上锁 */
-    if (rwl->w_active) {
-        status1 = EBUSY;
-    } else {
-        rwl->r_active++;
+
+    long start = RWL_STATS_NOW();
+    int status = rwl_readspin(rwl) ? 0 : rwl_readlock_slow(rwl);
+    if (status == 0) {
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, start);
     }
-    /* 解锁 */
-    status2 = pthread_mutex_unlock(&rwl->mutex);
-    if (status2 != 0) {
-        return status2;
+    return status;
+}
+
+int rwl_readtrylock(rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
     }
-    return status1;
+
+    /* 和快速路径一样：rwl_upgrade 在等读者离开的时候也会置上 RWL_WAITING，这时候新的读者不能进 */
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    do {
+        if (state & (RWL_WRITER | RWL_WAITING)) {
+            return EBUSY;
+        }
+    } while (!__atomic_compare_exchange_n(&rwl->state, &state, state + RWL_READER,
+        true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+    RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, 0L);
+    return 0;
 }
 
 int rwl_readunlock(rwlock_t* rwl)
@@ -153,15 +384,20 @@ int rwl_readunlock(rwlock_t* rwl)
     if (rwl->valid != RWLOCK_VALID) {
         return EINVAL;
     }
+
+    RWL_STATS_RELEASE(rwl, RWL_STATS_READ);
+    unsigned int state = __atomic_sub_fetch(&rwl->state, RWL_READER, __ATOMIC_RELEASE);
+    if (RWL_READERS(state) != 0 || !(state & RWL_WAITING)) {
+        return 0;
+    }
+
+    /* 最后一个读者走了，而且有人在等：读了以后就写 */
     status1 = pthread_mutex_lock(&rwl->mutex);
     if (status1 != 0) {
         return status1;
     }
     /* 上锁 */
-    rwl->r_active--;
-    if (rwl->r_active == 0 && rwl->w_wait > 0) { // 读了以后就写
-        status1 = pthread_cond_signal(&rwl->write);
-    }
+    status1 = rwl_wakeup(rwl);
     /* 解锁 */
     status2 = pthread_mutex_unlock(&rwl->mutex);
     if (status2 != 0) {
@@ -170,7 +406,80 @@ int rwl_readunlock(rwlock_t* rwl)
     return status1;
 }
 
+static int rwl_writelock_slow(rwlock_t* rwl)
+{
+    int status;
+
+    status = pthread_mutex_lock(&rwl->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    rwl->w_wait++;
+    pthread_cleanup_push(rwl_writecleanup, (void*)rwl);
+    while (1) {
+        unsigned int state = __atomic_fetch_or(&rwl->state, RWL_WAITING, __ATOMIC_ACQUIRE) | RWL_WAITING;
+        if (rwl_writable(rwl, state)) { // 没有读者，也没有写者
+            if (__atomic_compare_exchange_n(&rwl->state, &state, state | RWL_WRITER,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+        status = pthread_cond_wait(&rwl->write, &rwl->mutex);
+        if (status != 0) {
+            break;
+        }
+    }
+    pthread_cleanup_pop(0);
+    rwl->w_wait--;
+    rwl_clearwaiting(rwl);
+
+    /* 解锁 */
+    pthread_mutex_unlock(&rwl->mutex);
+    return status;
+}
+
 int rwl_writelock(rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+
+    /* 快速路径：锁是空的，也没有人在排队 */
+    unsigned int state = 0;
+    if (__atomic_compare_exchange_n(&rwl->state, &state, RWL_WRITER,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_WRITE, 0L);
+        return 0;
+    }
+
+    long start = RWL_STATS_NOW();
+    int status = rwl_writespin(rwl) ? 0 : rwl_writelock_slow(rwl);
+    if (status == 0) {
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_WRITE, start);
+    }
+    return status;
+}
+
+int rwl_writetrylock(rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+
+    /* 有人在排队（RWL_WAITING）的时候也不插队：谁先进由慢路径按策略决定，比如 RWL_PHASE_FAIR 的 admit */
+    unsigned int state = 0;
+    if (!__atomic_compare_exchange_n(&rwl->state, &state, RWL_WRITER,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return EBUSY;
+    }
+
+    RWL_STATS_ACQUIRE(rwl, RWL_STATS_WRITE, 0L);
+    return 0;
+}
+
+int rwl_writeunlock(rwlock_t* rwl)
 {
     int status;
 
@@ -178,62 +487,159 @@ int rwl_writelock(rwlock_t* rwl)
         return EINVAL;
     }
 
+    RWL_STATS_RELEASE(rwl, RWL_STATS_WRITE);
+
+    /* 快速路径：没有人在等 */
+    unsigned int state = RWL_WRITER;
+    if (__atomic_compare_exchange_n(&rwl->state, &state, 0,
+            false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+
     status = pthread_mutex_lock(&rwl->mutex);
     if (status != 0) {
         return status;
     }
     /* 上锁 */
 
-    if (rwl->w_active > 0 || rwl->r_active > 0) {
-        rwl->w_wait++;
-        pthread_cleanup_push(rwl_writecleanup, (void*)rwl);
+    __atomic_fetch_and(&rwl->state, ~RWL_WRITER, __ATOMIC_RELEASE);
+
+    rwl_endwrite(rwl);
 
-        while (rwl->w_active > 0 || rwl->r_active > 0) {
-            status = pthread_cond_wait(&rwl->write, &rwl->mutex);
-            if (status != 0) {
+    status = rwl_wakeup(rwl);
+    if (status != 0) {
+        pthread_mutex_unlock(&rwl->mutex);
+        return status;
+    }
+
+    /* 解锁 */
+    status = pthread_mutex_unlock(&rwl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    return status;
+}
+
+static void rwl_upgradelockcleanup(void* arg)
+{
+    rwl_waiter_t* waiter = (rwl_waiter_t*)arg;
+    rwlock_t* rwl = waiter->rwl;
+    rwl->u_wait--;
+    if (rwl->policy == RWL_PHASE_FAIR && waiter->gen != rwl->w_gen) {
+        rwl->admit--;
+    }
+    rwl_wakeup(rwl);
+    rwl_clearwaiting(rwl);
+    pthread_mutex_unlock(&rwl->mutex);
+}
+
+/**
+ * 可升级读者和读者一样遵守公平策略（RWL_PHASE_FAIR 下也算在 admit 里），另外还要等 RWL_UPGRADER 空出来
+ */
+static int rwl_upgradelock_slow(rwlock_t* rwl)
+{
+    int status;
+
+    status = pthread_mutex_lock(&rwl->mutex);
+    if (status != 0) {
+        return status;
+    }
+    /* 上锁 */
+    rwl_waiter_t waiter = { rwl, rwl->w_gen };
+    rwl->u_wait++;
+    pthread_cleanup_push(rwl_upgradelockcleanup, (void*)&waiter);
+    while (1) {
+        unsigned int state = __atomic_fetch_or(&rwl->state, RWL_WAITING, __ATOMIC_ACQUIRE) | RWL_WAITING;
+        if (!(state & RWL_UPGRADER) && rwl_readable(rwl, state, waiter.gen)) {
+            if (__atomic_compare_exchange_n(&rwl->state, &state, state | RWL_UPGRADER,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
                 break;
             }
+            continue;
+        }
+        status = pthread_cond_wait(&rwl->upgrade, &rwl->mutex);
+        if (status != 0) {
+            break;
         }
-        pthread_cleanup_pop(0);
-        rwl->w_wait--;
     }
+    pthread_cleanup_pop(0);
+    if (status == 0 && rwl->policy == RWL_PHASE_FAIR && waiter.gen != rwl->w_gen) {
+        rwl->admit--;
+    }
+    rwl->u_wait--;
+    rwl_clearwaiting(rwl);
 
     /* 解锁 */
     pthread_mutex_unlock(&rwl->mutex);
-    if (status != 0) {
-        return status;
+    return status;
+}
+
+int rwl_upgradelock(rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
     }
 
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    while (!(state & (RWL_WRITER | RWL_WAITING | RWL_UPGRADER))) {
+        if (__atomic_compare_exchange_n(&rwl->state, &state, state | RWL_UPGRADER,
+                true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, 0L);
+            return 0;
+        }
+    }
+
+    long start = RWL_STATS_NOW();
+    int status = rwl_upgradelock_slow(rwl);
+    if (status == 0) {
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, start);
+    }
     return status;
 }
 
-int rwl_writetrylock(rwlock_t* rwl)
+int rwl_upgradeunlock(rwlock_t* rwl)
 {
     int status1, status2;
+
     if (rwl->valid != RWLOCK_VALID) {
         return EINVAL;
     }
 
+    RWL_STATS_RELEASE(rwl, RWL_STATS_READ);
+    unsigned int state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    while (!(state & RWL_WAITING)) {
+        if (__atomic_compare_exchange_n(&rwl->state, &state, state & ~RWL_UPGRADER,
+                true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+
     status1 = pthread_mutex_lock(&rwl->mutex);
     if (status1 != 0) {
         return status1;
     }
-
-    if (rwl->w_active > 0 || rwl->r_active > 0) {
-        status1 = EBUSY;
-    } else {
-        rwl->w_active++;
-    }
-
+    /* 上锁 */
+    __atomic_fetch_and(&rwl->state, ~RWL_UPGRADER, __ATOMIC_RELEASE);
+    status1 = rwl_wakeup(rwl);
+    /* 解锁 */
     status2 = pthread_mutex_unlock(&rwl->mutex);
     if (status2 != 0) {
         return status2;
     }
-
     return status1;
 }
 
-int rwl_writeunlock(rwlock_t* rwl)
+static void rwl_upgradecleanup(void* arg)
+{
+    rwlock_t* rwl = (rwlock_t*)arg;
+    rwl->upgrading = 0; // 依然持有 RWL_UPGRADER，只是不再挡着读者了
+    rwl_wakeup(rwl);
+    rwl_clearwaiting(rwl);
+    pthread_mutex_unlock(&rwl->mutex);
+}
+
+int rwl_upgrade(rwlock_t* rwl)
 {
     int status;
 
@@ -241,33 +647,86 @@ int rwl_writeunlock(rwlock_t* rwl)
         return EINVAL;
     }
 
+    /* 快速路径：只有我们自己，没有读者，也没有人在排队 */
+    unsigned int state = RWL_UPGRADER;
+    if (__atomic_compare_exchange_n(&rwl->state, &state, RWL_WRITER,
+            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        RWL_STATS_RELEASE(rwl, RWL_STATS_READ); // 可升级读 的持有到拿到写锁为止，写的持有从这里开始
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_WRITE, 0L);
+        return 0;
+    }
+
+    long start = RWL_STATS_NOW();
+
     status = pthread_mutex_lock(&rwl->mutex);
     if (status != 0) {
         return status;
     }
     /* 上锁 */
-
-    rwl->w_active = 0;
-
-    if (rwl->r_wait > 0) {
-        status = pthread_cond_broadcast(&rwl->read); // 优先：读线程
-        if (status != 0) {
-            pthread_mutex_unlock(&rwl->mutex);
-            return status;
+    rwl->upgrading = 1;
+    pthread_cleanup_push(rwl_upgradecleanup, (void*)rwl);
+    while (1) {
+        /* 置上 RWL_WAITING：新来的读者走慢路径，被 upgrading 挡住；最后一个读者离开时会来唤醒我们 */
+        state = __atomic_fetch_or(&rwl->state, RWL_WAITING, __ATOMIC_ACQUIRE) | RWL_WAITING;
+        if (RWL_READERS(state) == 0) {
+            if (__atomic_compare_exchange_n(&rwl->state, &state, (state & ~RWL_UPGRADER) | RWL_WRITER,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
         }
-    } else if (rwl->w_wait > 0) {
-        status = pthread_cond_signal(&rwl->write);
+        status = pthread_cond_wait(&rwl->upgrade, &rwl->mutex);
         if (status != 0) {
-            pthread_mutex_unlock(&rwl->mutex);
-            return status;
+            break;
         }
     }
+    pthread_cleanup_pop(0);
+    rwl->upgrading = 0;
+    rwl_clearwaiting(rwl);
 
     /* 解锁 */
-    status = pthread_mutex_unlock(&rwl->mutex);
-    if (status != 0) {
-        return status;
+    pthread_mutex_unlock(&rwl->mutex);
+    if (status == 0) {
+        RWL_STATS_RELEASE(rwl, RWL_STATS_READ); // 失败的时候还持有 RWL_UPGRADER，读的持有还没结束
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_WRITE, start);
     }
-
     return status;
-}
\ No newline at end of file
+}
+
+int rwl_downgrade(rwlock_t* rwl)
+{
+    int status1, status2;
+
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+
+    RWL_STATS_RELEASE(rwl, RWL_STATS_WRITE);
+
+    /* 快速路径：没有人在等，写者直接变成一个读者 */
+    unsigned int state = RWL_WRITER;
+    if (__atomic_compare_exchange_n(&rwl->state, &state, RWL_READER,
+            false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, 0L);
+        return 0;
+    }
+
+    status1 = pthread_mutex_lock(&rwl->mutex);
+    if (status1 != 0) {
+        return status1;
+    }
+    /* 上锁 */
+    state = __atomic_load_n(&rwl->state, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&rwl->state, &state, (state & ~RWL_WRITER) + RWL_READER,
+        true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+    RWL_STATS_ACQUIRE(rwl, RWL_STATS_READ, 0L);
+    rwl_endwrite(rwl);
+    status1 = rwl_wakeup(rwl); // 等着的读者可以和我们一起读了
+    /* 解锁 */
+    status2 = pthread_mutex_unlock(&rwl->mutex);
+    if (status2 != 0) {
+        return status2;
+    }
+    return status1;
+}
@@ -1,17 +1,86 @@
 #ifndef __RWLOCK_HXX__
 #define __RWLOCK_HXX__
 
+#include <cstdio>
 #include <pthread.h>
 
+/**
+ * state：一个原子的字，把原来的 r_active / w_active 和 "有人在等" 编码在一起
+ *
+ *   bit 0     : RWL_WRITER，有写者持有
+ *   bit 1     : RWL_WAITING，有线程在慢路径（mutex + cond）里等，释放的时候要去 mutex 里唤醒
+ *   bit 2     : RWL_UPGRADER，有 可升级读者 持有（最多一个，和普通读者共存，和写者互斥）
+ *   bit 3 ... : 读者数量（以 RWL_READER 为单位）
+ *
+ * 没有竞争的时候，加锁、解锁都只是一次 CAS（或者一次 fetch_sub），不碰 mutex。
+ * 只要 RWL_WAITING 被置上，新来的线程就都走慢路径，由 mutex 里的代码决定谁先进
+ */
+#define RWL_WRITER 0x1u
+#define RWL_WAITING 0x2u
+#define RWL_UPGRADER 0x4u
+#define RWL_READER 0x8u
+#define RWL_READERS(state) ((state) / RWL_READER)
+
+/**
+ * 公平策略，rwl_init_policy 的时候选定：
+ *
+ * RWL_PREFER_READER : 默认，和原来一样：只要没有写者持有，读者就能进；写者释放时先唤醒读者。
+ *                     读很多的时候，写者可能一直等下去
+ * RWL_PREFER_WRITER : 只要有写者在排队，新的读者就要等；写者释放时先交给下一个写者
+ * RWL_PHASE_FAIR    : 读、写轮流：写者释放时，放行 在它持有期间排队的所有读者（一个读阶段），
+ *                     这些读者进去之后，才轮到下一个写者；写者排队时新来的读者要等到下一个读阶段。
+ *                     写者最多等一个读阶段 + 一个写阶段
+ */
+#define RWL_PREFER_READER 0
+#define RWL_PREFER_WRITER 1
+#define RWL_PHASE_FAIR 2
+
+/**
+ * 竞争统计：编译时 -DRWLOCK_STATS 打开，不打开的时候 rwlock_t 里没有这些字段，钩子也都展开成空语句，
+ * 锁的代码和原来完全一样。
+ *
+ * 读、写分开统计：拿到了多少次，其中多少次走了慢路径（被挡住了），
+ * 等待时间（进慢路径到拿到锁）和持有时间（拿到锁到释放）按 log2(ns) 做直方图。
+ * 读者的持有时间记在线程自己的表里，所以读锁要在同一个线程上释放才会被统计
+ */
+#define RWL_STATS_BUCKETS 32 // hist[i]：在 [2^(i-1), 2^i) ns，hist[0] 是 0
+#define RWL_STATS_READ 0
+#define RWL_STATS_WRITE 1
+
+typedef struct rwl_stat_tag {
+    unsigned long acquired;
+    unsigned long contended;
+    long wait_max; // ns
+    long hold_max;
+    unsigned long wait_hist[RWL_STATS_BUCKETS];
+    unsigned long hold_hist[RWL_STATS_BUCKETS];
+} rwl_stat_t;
+
+typedef struct rwl_stats_tag {
+    rwl_stat_t mode[2]; // 下标是 RWL_STATS_READ / RWL_STATS_WRITE
+    long write_start; // 写者拿到锁的时间，同一时刻只有一个写者
+    const char* name; // rwl_stats_name 之后才会出现在 rwl_stats_dump 里
+    struct rwlock_tag* next;
+} rwl_stats_t;
+
 typedef struct rwlock_tag {
-    pthread_mutex_t mutex;
+    pthread_mutex_t mutex; // 只保护慢路径：r_wait、w_wait，以及在 cond 上的睡眠
     pthread_cond_t read;
     pthread_cond_t write;
+    pthread_cond_t upgrade; // 等着拿 RWL_UPGRADER 的线程，和 等读者离开好升级的那个线程
     int valid;
-    int r_active;
-    int w_active;
+    unsigned int state;
     int r_wait;
     int w_wait;
+    int u_wait; // 等着拿 RWL_UPGRADER 的线程数
+    int upgrading; // 持有 RWL_UPGRADER 的线程正在 rwl_upgrade 里等读者离开，这时候新的读者不能进
+    int policy;
+    int admit; // RWL_PHASE_FAIR：上一个写者放行的、还没进来的读者数，不为 0 的时候写者不能进
+    unsigned int w_gen; // RWL_PHASE_FAIR：写者慢路径释放的次数，读者据此判断自己是不是被放行了
+    int spins; // 进慢路径之前自旋的圈数估计，见 spin_update
+#ifdef RWLOCK_STATS
+    rwl_stats_t stats;
+#endif
 } rwlock_t;
 
 #define RWLOCK_VALID 0xfacade
@@ -20,21 +89,24 @@ typedef struct rwlock_tag {
                                       \
     {                                 \
         PTHREAD_MUTEX_INITIALIZER,    \
+            PTHREAD_COND_INITIALIZER, \
             PTHREAD_COND_INITIALIZER, \
             PTHREAD_COND_INITIALIZER, \
             RWLOCK_VALID,             \
             0,                        \
             0,                        \
             0,                        \
-            0,                        \
     }
 
 extern int rwl_init(rwlock_t* rwlock);
 
+extern int rwl_init_policy(rwlock_t* rwlock, int policy);
+
 extern int rwl_destroy(rwlock_t* rwlock);
 
 extern int rwl_readlock(rwlock_t* rwlock);
 
+/* 两个 trylock 只走快速路径：有人在排队（RWL_WAITING）的时候不插队，直接返回 EBUSY，不会破坏公平策略 */
 extern int rwl_readtrylock(rwlock_t* rwlock);
 
 extern int rwl_readunlock(rwlock_t* rwlock);
@@ -45,4 +117,59 @@ extern int rwl_writetrylock(rwlock_t* rwlock);
 
 extern int rwl_writeunlock(rwlock_t* rwlock);
 
-#endif
\ No newline at end of file
+/**
+ * 可升级读：先查、查不到再改 的场景。
+ *
+ * rwl_upgradelock 拿到的锁可以和普通读者同时持有，但同一时刻只有一个可升级读者，而且和写者互斥，
+ * 所以在它持有期间读到的东西，升级之后依然成立，不用再查一遍。
+ * rwl_upgrade 等当前的读者离开（期间新读者不能进），然后原子地变成写锁，用 rwl_writeunlock 释放；
+ * 不需要写的话，用 rwl_upgradeunlock 释放。
+ * rwl_downgrade 把写锁原子地变成读锁，用 rwl_readunlock 释放
+ */
+extern int rwl_upgradelock(rwlock_t* rwlock);
+
+extern int rwl_upgradeunlock(rwlock_t* rwlock);
+
+extern int rwl_upgrade(rwlock_t* rwlock);
+
+extern int rwl_downgrade(rwlock_t* rwlock);
+
+/**
+ * 运行时查询。没有 -DRWLOCK_STATS 的时候返回 ENOSYS
+ * rwl_stats_name 给锁起个名字（只保存指针，不能是 NULL），登记到全局的表里，rwl_destroy 的时候自动去掉；
+ * rwl_stats_dump 打印名字是 name 的锁，name 是 NULL 的时候打印所有登记过的锁
+ */
+extern int rwl_stats_name(rwlock_t* rwlock, const char* name);
+extern int rwl_stats_get(rwlock_t* rwlock, int mode, rwl_stat_t* out);
+extern int rwl_stats_reset(rwlock_t* rwlock);
+extern int rwl_stats_dump(const char* name, FILE* out);
+
+#ifdef RWLOCK_STATS
+extern long rwl_stats_now(void);
+extern void rwl_stats_init(rwlock_t* rwlock);
+extern void rwl_stats_destroy(rwlock_t* rwlock);
+extern void rwl_stats_acquire(rwlock_t* rwlock, int mode, long wait_start);
+extern void rwl_stats_release(rwlock_t* rwlock, int mode);
+#define RWL_STATS_NOW() rwl_stats_now()
+#define RWL_STATS_INIT(rwlock) rwl_stats_init(rwlock)
+#define RWL_STATS_DESTROY(rwlock) rwl_stats_destroy(rwlock)
+#define RWL_STATS_ACQUIRE(rwlock, mode, wait_start) rwl_stats_acquire(rwlock, mode, wait_start)
+#define RWL_STATS_RELEASE(rwlock, mode) rwl_stats_release(rwlock, mode)
+#else
+#define RWL_STATS_NOW() 0L
+#define RWL_STATS_INIT(rwlock) \
+    do {                       \
+    } while (0)
+#define RWL_STATS_DESTROY(rwlock) \
+    do {                          \
+    } while (0)
+#define RWL_STATS_ACQUIRE(rwlock, mode, wait_start) \
+    do {                                            \
+        (void)(wait_start);                         \
+    } while (0)
+#define RWL_STATS_RELEASE(rwlock, mode) \
+    do {                                \
+    } while (0)
+#endif
+
+#endif
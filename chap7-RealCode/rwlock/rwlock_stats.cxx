@@ -0,0 +1,256 @@
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <pthread.h>
+
+#include "errors.hxx"
+#include "rwlock.hxx"
+
+#ifdef RWLOCK_STATS
+
+#define RWL_STATS_HELD 16 // 一个线程同时持有的读锁最多统计几把
+
+/* 登记过名字的锁 */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static rwlock_t* registry;
+
+/* 当前线程持有的读锁和拿到它们的时间，用来算读的持有时间 */
+typedef struct rwl_held_tag {
+    rwlock_t* rwl;
+    long start;
+} rwl_held_t;
+
+static thread_local rwl_held_t held[RWL_STATS_HELD];
+static thread_local int held_count;
+
+long rwl_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int stats_bucket(long ns)
+{
+    int bucket = 0;
+    while (ns > 0 && bucket < RWL_STATS_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void stats_max(long* max, long ns)
+{
+    long old = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while (ns > old && !__atomic_compare_exchange_n(max, &old, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/**
+ * @brief 清零之前先从表里摘掉：登记过的锁没有 rwl_destroy 就又 rwl_init 一遍的时候，
+ * 直接清零 next 会把表截断。只按地址比较，所以没初始化过的内存（next 是垃圾）也没关系
+ */
+void rwl_stats_init(rwlock_t* rwl)
+{
+    rwl_stats_destroy(rwl);
+    memset(&rwl->stats, 0, sizeof(rwl->stats));
+}
+
+void rwl_stats_destroy(rwlock_t* rwl)
+{
+    pthread_mutex_lock(&registry_mutex);
+    for (rwlock_t** prev = &registry; *prev != NULL; prev = &(*prev)->stats.next) {
+        if (*prev == rwl) {
+            *prev = rwl->stats.next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+}
+
+/**
+ * @brief 拿到锁以后调用。wait_start 是进慢路径之前的时间，快速路径拿到的是 0
+ *
+ * 读者之间是并发的，计数都用原子加；写者只有一个，write_start 直接写
+ */
+void rwl_stats_acquire(rwlock_t* rwl, int mode, long wait_start)
+{
+    rwl_stat_t* stat = &rwl->stats.mode[mode];
+    long now = rwl_stats_now();
+
+    __atomic_add_fetch(&stat->acquired, 1, __ATOMIC_RELAXED);
+    if (wait_start != 0) {
+        long wait = now - wait_start;
+        __atomic_add_fetch(&stat->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stat->wait_hist[stats_bucket(wait)], 1, __ATOMIC_RELAXED);
+        stats_max(&stat->wait_max, wait);
+    } else {
+        __atomic_add_fetch(&stat->wait_hist[0], 1, __ATOMIC_RELAXED);
+    }
+
+    if (mode == RWL_STATS_WRITE) {
+        rwl->stats.write_start = now;
+    } else if (held_count < RWL_STATS_HELD) {
+        held[held_count].rwl = rwl;
+        held[held_count].start = now;
+        held_count++;
+    }
+}
+
+/**
+ * @brief 释放锁之前调用（释放之后锁可能已经被 destroy 了）
+ *
+ */
+void rwl_stats_release(rwlock_t* rwl, int mode)
+{
+    rwl_stat_t* stat = &rwl->stats.mode[mode];
+    long start = -1;
+
+    if (mode == RWL_STATS_WRITE) {
+        start = rwl->stats.write_start;
+    } else {
+        for (int i = held_count - 1; i >= 0; i--) {
+            if (held[i].rwl == rwl) {
+                start = held[i].start;
+                held[i] = held[--held_count];
+                break;
+            }
+        }
+        if (start < 0) {
+            return; // 在别的线程上加的锁，或者表满了没记上
+        }
+    }
+
+    long hold = rwl_stats_now() - start;
+    __atomic_add_fetch(&stat->hold_hist[stats_bucket(hold)], 1, __ATOMIC_RELAXED);
+    stats_max(&stat->hold_max, hold);
+}
+
+int rwl_stats_name(rwlock_t* rwl, const char* name)
+{
+    if (rwl->valid != RWLOCK_VALID || name == NULL) {
+        return EINVAL; // name 同时表示登记过了，不能再设回 NULL
+    }
+
+    pthread_mutex_lock(&registry_mutex);
+    if (rwl->stats.name == NULL) {
+        rwl->stats.next = registry;
+        registry = rwl;
+    }
+    rwl->stats.name = name;
+    pthread_mutex_unlock(&registry_mutex);
+
+    return 0;
+}
+
+int rwl_stats_get(rwlock_t* rwl, int mode, rwl_stat_t* out)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+    if (mode != RWL_STATS_READ && mode != RWL_STATS_WRITE) {
+        return EINVAL;
+    }
+
+    rwl_stat_t* src = &rwl->stats.mode[mode];
+    out->acquired = __atomic_load_n(&src->acquired, __ATOMIC_RELAXED);
+    out->contended = __atomic_load_n(&src->contended, __ATOMIC_RELAXED);
+    out->wait_max = __atomic_load_n(&src->wait_max, __ATOMIC_RELAXED);
+    out->hold_max = __atomic_load_n(&src->hold_max, __ATOMIC_RELAXED);
+    for (int i = 0; i < RWL_STATS_BUCKETS; i++) {
+        out->wait_hist[i] = __atomic_load_n(&src->wait_hist[i], __ATOMIC_RELAXED);
+        out->hold_hist[i] = __atomic_load_n(&src->hold_hist[i], __ATOMIC_RELAXED);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief 清零计数；和正在进行的加锁、解锁并发的时候，那几次可能只被统计一半
+ *
+ */
+int rwl_stats_reset(rwlock_t* rwl)
+{
+    if (rwl->valid != RWLOCK_VALID) {
+        return EINVAL;
+    }
+
+    for (int mode = RWL_STATS_READ; mode <= RWL_STATS_WRITE; mode++) {
+        rwl_stat_t* stat = &rwl->stats.mode[mode];
+        __atomic_store_n(&stat->acquired, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->contended, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->wait_max, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&stat->hold_max, 0, __ATOMIC_RELAXED);
+        for (int i = 0; i < RWL_STATS_BUCKETS; i++) {
+            __atomic_store_n(&stat->wait_hist[i], 0, __ATOMIC_RELAXED);
+            __atomic_store_n(&stat->hold_hist[i], 0, __ATOMIC_RELAXED);
+        }
+    }
+
+    return 0;
+}
+
+static void stats_hist(FILE* out, const char* label, const unsigned long* hist)
+{
+    fprintf(out, "      %s (log2 ns: count)", label);
+    for (int bucket = 0; bucket < RWL_STATS_BUCKETS; bucket++) {
+        if (hist[bucket] != 0) {
+            fprintf(out, " %d:%lu", bucket, hist[bucket]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+int rwl_stats_dump(const char* name, FILE* out)
+{
+    static const char* modes[] = { "read", "write" };
+    rwl_stat_t stat;
+    int found = 0;
+
+    pthread_mutex_lock(&registry_mutex);
+    for (rwlock_t* rwl = registry; rwl != NULL; rwl = rwl->stats.next) {
+        if (name != NULL && strcmp(name, rwl->stats.name) != 0) {
+            continue;
+        }
+        found = 1;
+        fprintf(out, "%s\n", rwl->stats.name);
+        fprintf(out, "  mode     acquired   contended  contended%%    wait max    hold max\n");
+        for (int mode = RWL_STATS_READ; mode <= RWL_STATS_WRITE; mode++) {
+            rwl_stats_get(rwl, mode, &stat);
+            fprintf(out, "  %-5s %11lu %11lu %10.2f%% %11ld %11ld\n", modes[mode],
+                stat.acquired, stat.contended,
+                stat.acquired ? 100.0 * stat.contended / stat.acquired : 0.0,
+                stat.wait_max, stat.hold_max);
+            stats_hist(out, "wait", stat.wait_hist);
+            stats_hist(out, "hold", stat.hold_hist);
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+
+    return found ? 0 : ENOENT;
+}
+
+#else
+
+int rwl_stats_name(rwlock_t* rwl, const char* name)
+{
+    return ENOSYS;
+}
+
+int rwl_stats_get(rwlock_t* rwl, int mode, rwl_stat_t* out)
+{
+    return ENOSYS;
+}
+
+int rwl_stats_reset(rwlock_t* rwl)
+{
+    return ENOSYS;
+}
+
+int rwl_stats_dump(const char* name, FILE* out)
+{
+    return ENOSYS;
+}
+
+#endif
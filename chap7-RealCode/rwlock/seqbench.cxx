@@ -0,0 +1,177 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "rwlock.hxx"
+#include "seqlock.hxx"
+
+/**
+ * 读端扩展性：很多读者不停地读一个 4 个字的小记录，另外一个写者每 WRITE_INTERVAL 微秒更新一次。
+ * 同一个记录分别用 seqlock_t 和 rwlock_t 保护，看读者线程数翻倍的时候，总的读吞吐怎么变：
+ * rwl_readlock 每次都要改 state，读者都在抢同一个 cache line；seq_readbegin 只读不写
+ *
+ * usage: rw_seq [max threads] [seconds]
+ */
+
+#define WRITE_INTERVAL 100 // us
+
+typedef struct record_tag {
+    long stamp;
+    long value;
+    long square; // value * value，用来检查有没有读到写了一半的记录
+    long check; // stamp ^ value
+} record_t;
+
+typedef struct reader_tag {
+    alignas(64) pthread_t thread_id;
+    long reads;
+    long torn;
+} reader_t;
+
+static seqlock_t seqlock = SEQ_INITIALIZER;
+static rwlock_t rwlock = RWL_INITIALIZER;
+static record_t record;
+static int use_seq;
+static int stop;
+
+static void read_record(record_t* copy)
+{
+    int status;
+
+    if (use_seq) {
+        unsigned int seq;
+        do {
+            seq = seq_readbegin(&seqlock);
+            seq_read(copy, &record, sizeof(record));
+        } while (seq_readretry(&seqlock, seq));
+    } else {
+        status = rwl_readlock(&rwlock);
+        HANDLE_STATUS("read lock");
+        *copy = record;
+        status = rwl_readunlock(&rwlock);
+        HANDLE_STATUS("read unlock");
+    }
+}
+
+static void write_record(const record_t* update)
+{
+    int status;
+
+    if (use_seq) {
+        status = seq_writelock(&seqlock);
+        HANDLE_STATUS("seq write lock");
+        seq_write(&record, update, sizeof(record));
+        status = seq_writeunlock(&seqlock);
+        HANDLE_STATUS("seq write unlock");
+    } else {
+        status = rwl_writelock(&rwlock);
+        HANDLE_STATUS("write lock");
+        record = *update;
+        status = rwl_writeunlock(&rwlock);
+        HANDLE_STATUS("write unlock");
+    }
+}
+
+static void* reader_routine(void* arg)
+{
+    reader_t* self = (reader_t*)arg;
+    record_t copy;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        read_record(&copy);
+        if (copy.square != copy.value * copy.value || copy.check != (copy.stamp ^ copy.value)) {
+            self->torn++;
+        }
+        self->reads++;
+    }
+
+    return NULL;
+}
+
+static void* writer_routine(void* arg)
+{
+    long* writes = (long*)arg;
+    record_t update;
+
+    while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+        update.stamp = *writes;
+        update.value = *writes * 7 + 3;
+        update.square = update.value * update.value;
+        update.check = update.stamp ^ update.value;
+        write_record(&update);
+        (*writes)++;
+        usleep(WRITE_INTERVAL);
+    }
+
+    return NULL;
+}
+
+static double run(int threads, int seconds, long* torn)
+{
+    int status;
+    std::vector<reader_t> readers(threads);
+    pthread_t writer_id;
+    long writes = 0;
+
+    stop = 0;
+    record = { 0, 3, 9, 3 };
+
+    for (int i = 0; i < threads; i++) {
+        readers[i].reads = 0;
+        readers[i].torn = 0;
+        status = pthread_create(&readers[i].thread_id, NULL, reader_routine, &readers[i]);
+        HANDLE_STATUS("create reader");
+    }
+    status = pthread_create(&writer_id, NULL, writer_routine, &writes);
+    HANDLE_STATUS("create writer");
+
+    sleep(seconds);
+    __atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+    long reads = 0;
+    for (int i = 0; i < threads; i++) {
+        status = pthread_join(readers[i].thread_id, NULL);
+        HANDLE_STATUS("join reader");
+        reads += readers[i].reads;
+        *torn += readers[i].torn;
+    }
+    status = pthread_join(writer_id, NULL);
+    HANDLE_STATUS("join writer");
+
+    return (double)reads / seconds;
+}
+
+int main(int argc, char* argv[])
+{
+    int max_threads = 2 * sysconf(_SC_NPROCESSORS_ONLN);
+    int seconds = 1;
+
+    if (argc > 1) {
+        max_threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        seconds = atoi(argv[2]);
+    }
+    if (max_threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [max threads] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    printf("1 writer every %d us, %d s per run\n", WRITE_INTERVAL, seconds);
+    printf("%8s %14s %14s %8s %10s\n", "readers", "seqlock r/s", "rwlock r/s", "ratio", "torn");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        long torn = 0;
+        use_seq = 1;
+        double seq = run(threads, seconds, &torn);
+        use_seq = 0;
+        double rw = run(threads, seconds, &torn);
+        printf("%8d %14.0f %14.0f %8.2f %10ld\n", threads, seq, rw, seq / rw, torn);
+    }
+
+    return 0;
+}
@@ -0,0 +1,173 @@
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+
+#include "errors.hxx"
+#include "seqlock.hxx"
+#include "spin.hxx"
+
+int seq_init(seqlock_t* sl)
+{
+    int status;
+
+    sl->sequence = 0;
+
+    status = pthread_mutex_init(&sl->mutex, NULL);
+    if (status != 0) {
+        return status;
+    }
+
+    sl->valid = SEQLOCK_VALID;
+
+    return 0;
+}
+
+int seq_destroy(seqlock_t* sl)
+{
+    int status;
+
+    if (sl->valid != SEQLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_trylock(&sl->mutex);
+    if (status != 0) {
+        return status; // EBUSY：有写者
+    }
+
+    sl->valid = 0;
+    status = pthread_mutex_unlock(&sl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    return pthread_mutex_destroy(&sl->mutex);
+}
+
+/**
+ * @brief 等到没有写者，返回这时候的 sequence（一定是偶数）
+ *
+ * 读者不能在这里睡：写者不知道有谁在等它，也不会去唤醒。写得久的话就让出 cpu
+ */
+unsigned int seq_readbegin(seqlock_t* sl)
+{
+    int spins = spin_limit();
+    unsigned int seq;
+
+    for (int spin = 0; (seq = __atomic_load_n(&sl->sequence, __ATOMIC_ACQUIRE)) & 1; spin++) {
+        if (spin < spins) {
+            cpu_relax();
+        } else {
+            sched_yield();
+        }
+    }
+
+    return seq;
+}
+
+/**
+ * @brief 读完了：sequence 没变，说明拷贝的时候没有写者，返回 0；否则返回 1，要重读
+ *
+ * acquire fence 保证上面对数据的读 不会被挪到下面对 sequence 的读之后
+ */
+int seq_readretry(seqlock_t* sl, unsigned int start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->sequence, __ATOMIC_RELAXED) != start;
+}
+
+/**
+ * @brief 写者持有 mutex 以后：sequence 变成奇数，再写数据
+ *
+ * release fence 保证 sequence 的修改 先于后面对数据的写 被看到：读者看到了新数据，就一定看到了奇数
+ */
+static void seq_writebegin(seqlock_t* sl)
+{
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+int seq_writelock(seqlock_t* sl)
+{
+    int status;
+
+    if (sl->valid != SEQLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_lock(&sl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    seq_writebegin(sl);
+
+    return 0;
+}
+
+int seq_writetrylock(seqlock_t* sl)
+{
+    int status;
+
+    if (sl->valid != SEQLOCK_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_trylock(&sl->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    seq_writebegin(sl);
+
+    return 0;
+}
+
+int seq_writeunlock(seqlock_t* sl)
+{
+    if (sl->valid != SEQLOCK_VALID) {
+        return EINVAL;
+    }
+
+    /* 数据写完了才能变回偶数 */
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELEASE);
+
+    return pthread_mutex_unlock(&sl->mutex);
+}
+
+/**
+ * 对齐的时候按 long 一个字一个字地拷，否则按字节
+ */
+void seq_read(void* dst, const void* src, size_t size)
+{
+    if (((uintptr_t)dst | (uintptr_t)src | size) % sizeof(long) == 0) {
+        long* d = (long*)dst;
+        const long* s = (const long*)src;
+        for (size_t i = 0; i < size / sizeof(long); i++) {
+            d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+        }
+    } else {
+        unsigned char* d = (unsigned char*)dst;
+        const unsigned char* s = (const unsigned char*)src;
+        for (size_t i = 0; i < size; i++) {
+            d[i] = __atomic_load_n(&s[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void seq_write(void* dst, const void* src, size_t size)
+{
+    if (((uintptr_t)dst | (uintptr_t)src | size) % sizeof(long) == 0) {
+        long* d = (long*)dst;
+        const long* s = (const long*)src;
+        for (size_t i = 0; i < size / sizeof(long); i++) {
+            __atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+        }
+    } else {
+        unsigned char* d = (unsigned char*)dst;
+        const unsigned char* s = (const unsigned char*)src;
+        for (size_t i = 0; i < size; i++) {
+            __atomic_store_n(&d[i], s[i], __ATOMIC_RELAXED);
+        }
+    }
+}
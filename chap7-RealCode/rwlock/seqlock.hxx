@@ -0,0 +1,59 @@
+#ifndef __SEQLOCK_HXX__
+#define __SEQLOCK_HXX__
+
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * seqlock：给很小的、读非常多的 POD 记录用（计数器、时间戳、配置快照）
+ *
+ * 写者之间用 mutex 互斥，写之前、写之后各把 sequence 加一，所以 sequence 是奇数的时候有写者在写。
+ * 读者不加锁、也不写任何共享的东西，只是记下 sequence，拷贝数据，再看一眼 sequence：
+ * 变了（或者一开始就是奇数）就说明拷贝的时候被写者打断了，重新来一次
+ *
+ *     unsigned int seq;
+ *     do {
+ *         seq = seq_readbegin(&sl);
+ *         seq_read(&copy, &record, sizeof(record));
+ *     } while (seq_readretry(&sl, seq));
+ *
+ * 读者可能读到写了一半的数据，所以只能拷贝出来再用，不能在里面跟指针；写者很多的时候读者会一直重试
+ */
+typedef struct seqlock_tag {
+    pthread_mutex_t mutex; // 写者之间互斥
+    int valid;
+    unsigned int sequence; // 奇数：有写者正在写
+} seqlock_t;
+
+#define SEQLOCK_VALID 0x5efacade
+
+#define SEQ_INITIALIZER            \
+    {                              \
+        PTHREAD_MUTEX_INITIALIZER, \
+            SEQLOCK_VALID,         \
+            0                      \
+    }
+
+extern int seq_init(seqlock_t* seqlock);
+
+extern int seq_destroy(seqlock_t* seqlock);
+
+extern unsigned int seq_readbegin(seqlock_t* seqlock);
+
+extern int seq_readretry(seqlock_t* seqlock, unsigned int start);
+
+extern int seq_writelock(seqlock_t* seqlock);
+
+extern int seq_writetrylock(seqlock_t* seqlock);
+
+extern int seq_writeunlock(seqlock_t* seqlock);
+
+/**
+ * 拷贝 被保护的记录：读者在 seq_readbegin / seq_readretry 之间用 seq_read，写者在持有锁的时候用 seq_write。
+ * 每个字都是原子的（relaxed）读写，和写者并发的时候读到的是 撕裂的 但不是未定义的数据，retry 会把它丢掉
+ */
+extern void seq_read(void* dst, const void* src, size_t size);
+
+extern void seq_write(void* dst, const void* src, size_t size);
+
+#endif
@@ -3,9 +3,71 @@ set_toolchains("@llvm")
 
 -- add_requires("boost")
 
+-- 锁本身，没有 main，给下面的测试程序链接用
 target("rw") do
+    set_kind("static")
+    add_files("./rwlock.cxx", "./rwlock_stats.cxx", "./brlock.cxx", "./seqlock.cxx", "./rcu.cxx", "./combine.cxx", "./hashmap.cxx")
+	-- add_defines("RWLOCK_STATS", {public = true}) -- 打开竞争统计
+	set_languages("cxx20")
+	set_targetdir("./build")
+end
+
+-- 三种公平策略下，写者的等待时间
+target("rw_fair") do
+    set_kind("binary")
+    add_deps("rw")
+    add_files("./fairness.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
+
+-- 小记录的读端扩展性：seqlock_t 和 rwlock_t
+target("rw_seq") do
+    set_kind("binary")
+    add_deps("rw")
+    add_files("./seqbench.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
+
+-- 很短的写操作：rwl_writelock 和 flat combining
+target("rw_combine") do
+    set_kind("binary")
+    add_deps("rw")
+    add_files("./combinebench.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
+
+-- 读写比例扫描：rwlock_t、pthread_rwlock_t、std::shared_mutex
+target("rw_bench") do
+    set_kind("binary")
+    add_deps("rw")
+    add_files("./rwbench.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
+
+-- 分段锁的哈希表 和 一把全局锁的哈希表
+target("rw_hashmap") do
+    set_kind("binary")
+    add_deps("rw")
+    add_files("./hmbench.cxx")
+	set_languages("cxx20")
+	set_optimize("fastest")
+	set_targetdir("./build")
+end
+
+-- rcu_t：宽限期内不能释放，读者走了以后都要回收掉
+target("rw_rcu") do
     set_kind("binary")
-    add_files("./*.cxx")
+    add_deps("rw")
+    add_files("./rcubench.cxx")
 	set_languages("cxx20")
+	set_optimize("fastest")
 	set_targetdir("./build")
-end
\ No newline at end of file
+end
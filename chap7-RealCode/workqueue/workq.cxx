@@ -6,49 +6,513 @@
 #include <cstring>
 #include <ctime>
 #include <pthread.h>
+#include <sched.h>
 #include <time.h>
 
 #include "errors.hxx"
 #include "workq.hxx"
 
+/* 调试输出：每个元素都要打好几行，编译时 -DDEBUG 才打开 */
+#ifdef DEBUG
+#define DPRINTF(arg) printf arg
+#else
+#define DPRINTF(arg)
+#endif
+
+static void* workq_server(void* arg);
+
+/* 当前线程是哪个 workq 的 worker，不是 worker 就是 NULL */
+static thread_local workq_t* workq_current;
+
+/* CLOCK_MONOTONIC，ns */
+static long workq_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+int workq_attr_init(workq_attr_t* attr)
+{
+    attr->backend = WORKQ_LIST;
+    attr->capacity = WORKQ_RING_SIZE;
+    attr->persistent = 0;
+    CPU_ZERO(&attr->cpus);
+    workq_policy_init(&attr->policy);
+    return 0;
+}
+
+int workq_attr_setbackend(workq_attr_t* attr, int backend)
+{
+    if (backend != WORKQ_LIST && backend != WORKQ_RING && backend != WORKQ_STEAL) {
+        return EINVAL;
+    }
+    attr->backend = backend;
+    return 0;
+}
+
+int workq_attr_setcapacity(workq_attr_t* attr, unsigned long capacity)
+{
+    if (capacity < 2) {
+        return EINVAL;
+    }
+    attr->capacity = capacity;
+    return 0;
+}
+
+int workq_attr_setpolicy(workq_attr_t* attr, const workq_policy_t* policy)
+{
+    if (policy->min_workers < 0 || policy->max_workers < 0
+        || (policy->max_workers > 0 && policy->min_workers > policy->max_workers)
+        || policy->idle_timeout <= 0 || policy->hysteresis < 0
+        || policy->grow_depth < 0 || policy->grow_latency < 0) {
+        return EINVAL;
+    }
+    attr->policy = *policy;
+    if (attr->policy.grow == NULL) {
+        attr->policy.grow = workq_policy_grow;
+    }
+    if (attr->policy.shrink == NULL) {
+        attr->policy.shrink = workq_policy_shrink;
+    }
+    return 0;
+}
+
+int workq_policy_init(workq_policy_t* policy)
+{
+    policy->min_workers = 0;
+    policy->max_workers = 0;
+    policy->idle_timeout = 2000;
+    policy->hysteresis = 0;
+    policy->grow_depth = 0;
+    policy->grow_latency = 0;
+    policy->grow = workq_policy_grow;
+    policy->shrink = workq_policy_shrink;
+    return 0;
+}
+
+/**
+ * @brief 默认的增长策略：不到 min_workers 先补够；
+ * 否则 排队的元素平均到每个 worker 超过 grow_depth，或者 入队到出队的延迟超过 grow_latency，就给没人管的新元素各加一个 worker
+ *
+ * 默认 grow_depth 是 0、grow_latency 不看：有没人管的新元素就加，和原来一样
+ */
+int workq_policy_grow(const workq_policy_t* policy, const workq_load_t* load)
+{
+    if (load->workers < policy->min_workers) {
+        int lack = policy->min_workers - load->workers;
+        return lack > load->pending ? lack : load->pending;
+    }
+    if (load->pending == 0) {
+        return 0;
+    }
+    if (load->workers == 0) {
+        return load->pending; // 一个 worker 都没有，不加就没人干活了
+    }
+    if (load->depth > load->workers * policy->grow_depth) {
+        return load->pending;
+    }
+    if (policy->grow_latency > 0 && load->latency > policy->grow_latency) {
+        return load->pending;
+    }
+    return 0;
+}
+
+/**
+ * @brief 默认的收缩策略：闲够 idle_timeout 的 worker，只要还多于 min_workers，而且离上次要增长已经过了 hysteresis，就退出
+ *
+ * hysteresis 防止锯齿形的负载下 刚创建的 worker 马上又退出，下一个波峰再创建
+ */
+int workq_policy_shrink(const workq_policy_t* policy, const workq_load_t* load)
+{
+    return load->workers > policy->min_workers && load->since_grow >= policy->hysteresis * 1000000;
+}
+
+int workq_attr_setpersistent(workq_attr_t* attr, int persistent)
+{
+    attr->persistent = persistent != 0;
+    return 0;
+}
+
+int workq_attr_setaffinity(workq_attr_t* attr, const cpu_set_t* cpus)
+{
+    attr->cpus = *cpus;
+    return 0;
+}
+
+/**
+ * @brief workq_init_attr 的时候一次把 parallelism 个 worker 都创建出来，第 i 个绑到 cpus 里的第 i 个 cpu 上（不够就绕回来）
+ *
+ * 失败了的话，已经创建的 worker 由调用者 workq_destroy 收回
+ */
+static int workq_prespawn(workq_t* wq, const cpu_set_t* cpus)
+{
+    int status;
+    pthread_t id;
+    pthread_attr_t attr;
+    int ncpus = CPU_COUNT(cpus);
+    int cpu = -1;
+
+    status = pthread_mutex_lock(&wq->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    for (int i = 0; i < wq->parallelism; i++) {
+        status = pthread_attr_init(&attr);
+        if (status != 0) {
+            break;
+        }
+        status = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (status == 0 && ncpus > 0) {
+            do { // 下一个在 cpus 里的 cpu
+                cpu = (cpu + 1) % CPU_SETSIZE;
+            } while (!CPU_ISSET(cpu, cpus));
+            cpu_set_t one;
+            CPU_ZERO(&one);
+            CPU_SET(cpu, &one);
+            status = pthread_attr_setaffinity_np(&attr, sizeof(one), &one);
+        }
+        if (status == 0) {
+            status = pthread_create(&id, &attr, workq_server, (void*)wq);
+        }
+        pthread_attr_destroy(&attr);
+        if (status != 0) {
+            break;
+        }
+        __atomic_add_fetch(&wq->counter, 1, __ATOMIC_SEQ_CST);
+    }
+
+    pthread_mutex_unlock(&wq->mutex);
+    return status;
+}
+
+/**
+ * @brief 格子 i 的序号一开始是 i：空的，等着第 i 个生产者
+ *
+ */
+static int workq_ring_init(workq_ring_t* ring, unsigned long capacity)
+{
+    unsigned long size = 2;
+    while (size < capacity) {
+        size *= 2;
+    }
+
+    ring->cells = (workq_cell_t*)malloc(size * sizeof(workq_cell_t));
+    if (ring->cells == NULL) {
+        return ENOMEM;
+    }
+    for (unsigned long i = 0; i < size; i++) {
+        ring->cells[i].sequence = i;
+    }
+    ring->mask = size - 1;
+    ring->enqueue = 0;
+    ring->dequeue = 0;
+
+    return 0;
+}
+
+/**
+ * 生产者：看自己下标上的格子，序号 == 下标 说明空着，CAS 抢下这个下标，放进数据，再把序号改成 下标 + 1；
+ * 序号 < 下标 说明还没被上一圈的消费者取走，队列满了；序号 > 下标 说明别的生产者抢先了，重新读下标
+ */
+static int workq_ring_push(workq_ring_t* ring, void* data, long stamp)
+{
+    unsigned long pos = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+
+    while (1) {
+        workq_cell_t* cell = &ring->cells[pos & ring->mask];
+        long diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->enqueue, &pos, pos + 1,
+                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                cell->data = data;
+                cell->stamp = stamp;
+                __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return EAGAIN;
+        } else {
+            pos = __atomic_load_n(&ring->enqueue, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * 消费者：序号 == 下标 + 1 说明放好了，CAS 抢下这个下标，取走数据，
+ * 再把序号改成 下标 + 格子数（下一圈的生产者就能用了）
+ */
+static int workq_ring_pop(workq_ring_t* ring, void** data, long* stamp)
+{
+    unsigned long pos = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+
+    while (1) {
+        workq_cell_t* cell = &ring->cells[pos & ring->mask];
+        long diff = (long)(__atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE) - (pos + 1));
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring->dequeue, &pos, pos + 1,
+                    true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *data = cell->data;
+                *stamp = cell->stamp;
+                __atomic_store_n(&cell->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return EAGAIN;
+        } else {
+            pos = __atomic_load_n(&ring->dequeue, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* 当前线程是哪个 workq 的哪个 worker，不是 worker 就是 NULL */
+static thread_local workq_worker_t* workq_self;
+
+static workq_array_t* workq_array_new(long size, workq_array_t* prev)
+{
+    workq_array_t* array = (workq_array_t*)malloc(sizeof(workq_array_t));
+    if (array == NULL) {
+        return NULL;
+    }
+    array->buf = (void**)malloc(size * sizeof(void*));
+    if (array->buf == NULL) {
+        free(array);
+        return NULL;
+    }
+    array->size = size;
+    array->prev = prev;
+    return array;
+}
+
+static int workq_deque_init(workq_deque_t* deque)
+{
+    deque->top = 0;
+    deque->bottom = 0;
+    deque->array = workq_array_new(WORKQ_DEQUE_SIZE, NULL);
+    return deque->array == NULL ? ENOMEM : 0;
+}
+
+static void workq_deque_destroy(workq_deque_t* deque)
+{
+    workq_array_t* array = deque->array;
+    while (array != NULL) {
+        workq_array_t* prev = array->prev;
+        free(array->buf);
+        free(array);
+        array = prev;
+    }
+}
+
+/**
+ * 只有主人调用：放到底部，满了就换一个两倍大的数组（旧的挂在 prev 上，偷的人可能还拿着）
+ *
+ */
+static int workq_deque_push(workq_deque_t* deque, void* data)
+{
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    workq_array_t* array = deque->array;
+
+    if (b - t > array->size - 1) {
+        workq_array_t* bigger = workq_array_new(array->size * 2, array);
+        if (bigger == NULL) {
+            return ENOMEM;
+        }
+        for (long i = t; i < b; i++) {
+            bigger->buf[i & (bigger->size - 1)] = __atomic_load_n(&array->buf[i & (array->size - 1)], __ATOMIC_RELAXED);
+        }
+        __atomic_store_n(&deque->array, bigger, __ATOMIC_RELEASE);
+        array = bigger;
+    }
+    __atomic_store_n(&array->buf[b & (array->size - 1)], data, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * 只有主人调用：从底部取。先把 bottom 减一 “占住” 最后一个，
+ * 只剩一个的时候要和偷的人 CAS top 抢
+ */
+static int workq_deque_take(workq_deque_t* deque, void** data)
+{
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    workq_array_t* array = deque->array;
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if (t > b) { // 空的
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    *data = __atomic_load_n(&array->buf[b & (array->size - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        int won = __atomic_compare_exchange_n(&deque->top, &t, t + 1,
+            false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        return won;
+    }
+    return 1;
+}
+
+/**
+ * 谁都可以调用：从顶部偷一个，CAS 输了就算没偷到
+ *
+ */
+static int workq_deque_steal(workq_deque_t* deque, void** data)
+{
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+
+    if (t >= b) {
+        return 0;
+    }
+    workq_array_t* array = __atomic_load_n(&deque->array, __ATOMIC_ACQUIRE);
+    void* item = __atomic_load_n(&array->buf[t & (array->size - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1,
+            false, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    *data = item;
+    return 1;
+}
+
+/**
+ * @brief 从一个随机的位置开始，把别人的队列挨个偷一遍
+ *
+ */
+static int workq_steal(workq_t* wq, workq_worker_t* self, void** data)
+{
+    int start = rand_r(&self->seed) % wq->parallelism;
+
+    for (int i = 0; i < wq->parallelism; i++) {
+        workq_worker_t* victim = &wq->workers[(start + i) % wq->parallelism];
+        if (victim != self && workq_deque_steal(&victim->deque, data)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int workq_init(workq_t* wq, int threads, void (*engin)(void*))
+{
+    return workq_init_attr(wq, threads, engin, NULL);
+}
+
+int workq_init_attr(workq_t* wq, int threads, void (*engin)(void*), const workq_attr_t* wq_attr)
 {
     int status = 0;
+    workq_attr_t defaults;
+
+    if (wq_attr == NULL) {
+        workq_attr_init(&defaults);
+        wq_attr = &defaults;
+    }
+
+    /* 只有一开始就创建好的 worker 才会绑 cpu */
+    if (CPU_COUNT(&wq_attr->cpus) > 0 && !wq_attr->persistent) {
+        return EINVAL;
+    }
+
+    /* 策略里的 max_workers 比 threads 小的话，以它为准 */
+    if (wq_attr->policy.max_workers > 0 && wq_attr->policy.max_workers < threads) {
+        threads = wq_attr->policy.max_workers;
+    }
+
+    wq->backend = wq_attr->backend;
+    if (wq->backend == WORKQ_RING) {
+        status = workq_ring_init(&wq->ring, wq_attr->capacity);
+        if (status != 0) {
+            return status;
+        }
+    }
+
+    wq->workers = NULL;
+    if (wq->backend == WORKQ_STEAL) {
+        wq->workers = (workq_worker_t*)aligned_alloc(64, threads * sizeof(workq_worker_t));
+        if (wq->workers == NULL) {
+            return ENOMEM;
+        }
+        for (int i = 0; i < threads; i++) {
+            status = workq_deque_init(&wq->workers[i].deque);
+            if (status != 0) {
+                while (--i >= 0) {
+                    workq_deque_destroy(&wq->workers[i].deque);
+                }
+                free(wq->workers);
+                return status;
+            }
+            wq->workers[i].wq = wq;
+            wq->workers[i].busy = 0;
+            wq->workers[i].seed = i + 1;
+        }
+    }
 
     /* 初始化属性 */
     status = pthread_attr_init(&wq->attr);
     if (status != 0) {
-        return status;
+        goto free_ring;
     }
 
     /* 将属性设置为 detach */
     status = pthread_attr_setdetachstate(&wq->attr, PTHREAD_CREATE_DETACHED);
     if (status != 0) {
-        pthread_attr_destroy(&wq->attr);
-        return status;
+        goto free_attr;
     }
 
     status = pthread_mutex_init(&wq->mutex, NULL);
     if (status != 0) {
-        pthread_attr_destroy(&wq->attr);
-        return status;
+        goto free_attr;
     }
 
     status = pthread_cond_init(&wq->cv, NULL);
     if (status != 0) {
         pthread_mutex_destroy(&wq->mutex);
-        pthread_attr_destroy(&wq->attr);
-        return status;
+        goto free_attr;
     }
 
     wq->quit = 0;
     wq->first = wq->last = NULL;
+    wq->free = NULL;
+    wq->slabs = NULL;
+    wq->outstanding = 0;
+    wq->cached = 0;
     wq->parallelism = threads; // 最大 线程数
     wq->counter = 0; // 还没有 创建的线程呢
     wq->idle = 0; // 应该是：parallelism >= counter >= idle
+    wq->signaled = 0;
     wq->engine = engin;
+    wq->persistent = wq_attr->persistent;
+    wq->policy = wq_attr->policy;
+    wq->latency = 0;
+    wq->grown = workq_now();
     wq->valid = WORKQ_VALID;
 
+    if (wq->persistent) {
+        status = workq_prespawn(wq, &wq_attr->cpus);
+        if (status != 0) {
+            workq_destroy(wq);
+            wq->valid = 0; // 已经毁掉了，别让调用者再 add / destroy 一次
+        }
+    }
+
+    return status;
+
+free_attr:
+    pthread_attr_destroy(&wq->attr);
+free_ring:
+    if (wq->backend == WORKQ_RING) {
+        free(wq->ring.cells);
+    }
+    if (wq->workers != NULL) {
+        for (int i = 0; i < threads; i++) {
+            workq_deque_destroy(&wq->workers[i].deque);
+        }
+        free(wq->workers);
+    }
     return status;
 }
 
@@ -90,6 +554,7 @@ int workq_destroy(workq_t* wq)
             }
         }
     }
+    wq->valid = 0; // 线程都退出了，之后的 add / destroy 返回 EINVAL
 
     /* 解锁 */
     status = pthread_mutex_unlock(&wq->mutex);
@@ -97,6 +562,21 @@ int workq_destroy(workq_t* wq)
         return status;
     }
 
+    if (wq->backend == WORKQ_RING) {
+        free(wq->ring.cells);
+    }
+    if (wq->workers != NULL) {
+        for (int i = 0; i < wq->parallelism; i++) {
+            workq_deque_destroy(&wq->workers[i].deque);
+        }
+        free(wq->workers);
+    }
+    while (wq->slabs != NULL) {
+        workq_slab_t* next = wq->slabs->next;
+        free(wq->slabs);
+        wq->slabs = next;
+    }
+
     status = pthread_mutex_destroy(&wq->mutex);
     status1 = pthread_cond_destroy(&wq->cv);
     status2 = pthread_attr_destroy(&wq->attr);
@@ -105,6 +585,223 @@ int workq_destroy(workq_t* wq)
     return (status ? status : (status1 ? status1 : status2));
 }
 
+/**
+ * @brief 持有 mutex 时调用：从 freelist 拿一个元素，空了再 malloc 一整块 WORKQ_SLAB 个
+ *
+ * 入队、出队本来就在 mutex 里，所以 freelist 不用另外加锁；稳定以后不再碰 malloc / free
+ */
+static workq_ele_t* workq_ele_alloc(workq_t* wq)
+{
+    if (wq->free == NULL) {
+        workq_slab_t* slab = (workq_slab_t*)malloc(sizeof(workq_slab_t));
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->next = wq->slabs;
+        wq->slabs = slab;
+        for (int i = 0; i < WORKQ_SLAB; i++) {
+            slab->ele[i].next = wq->free;
+            wq->free = &slab->ele[i];
+        }
+        wq->cached += WORKQ_SLAB;
+    }
+
+    workq_ele_t* we = wq->free;
+    wq->free = we->next;
+    wq->cached--;
+    wq->outstanding++;
+    return we;
+}
+
+static void workq_ele_free(workq_t* wq, workq_ele_t* we)
+{
+    we->next = wq->free;
+    wq->free = we;
+    wq->cached++;
+    wq->outstanding--;
+}
+
+int workq_nodes(workq_t* wq, long* outstanding, long* cached)
+{
+    int status;
+
+    if (wq->valid != WORKQ_VALID) {
+        return EINVAL;
+    }
+
+    status = pthread_mutex_lock(&wq->mutex);
+    if (status != 0) {
+        return status;
+    }
+    if (outstanding != NULL) {
+        *outstanding = wq->outstanding;
+    }
+    if (cached != NULL) {
+        *cached = wq->cached;
+    }
+    return pthread_mutex_unlock(&wq->mutex);
+}
+
+/**
+ * @brief 持有 mutex 时调用：排队的元素数。WORKQ_RING、WORKQ_STEAL 的队列不归 mutex 管，只是个近似值
+ *
+ */
+static long workq_depth(workq_t* wq)
+{
+    long depth = wq->outstanding;
+
+    if (wq->backend == WORKQ_RING) {
+        depth = __atomic_load_n(&wq->ring.enqueue, __ATOMIC_RELAXED) - __atomic_load_n(&wq->ring.dequeue, __ATOMIC_RELAXED);
+    } else if (wq->backend == WORKQ_STEAL) {
+        for (int i = 0; i < wq->parallelism; i++) {
+            workq_deque_t* deque = &wq->workers[i].deque;
+            long size = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+            depth += size > 0 ? size : 0;
+        }
+    }
+    return depth;
+}
+
+/**
+ * @brief 持有 mutex 时调用：给策略看的负载
+ *
+ */
+static void workq_load(workq_t* wq, workq_load_t* load)
+{
+    load->workers = wq->counter;
+    load->idle = wq->idle - wq->signaled;
+    load->pending = 0;
+    load->depth = workq_depth(wq);
+    load->latency = __atomic_load_n(&wq->latency, __ATOMIC_RELAXED);
+    load->since_grow = workq_now() - wq->grown;
+}
+
+/**
+ * @brief 出队的时候调用：更新 入队到出队 的延迟（EWMA，和 spin 的估计一样每次走 1/8）
+ *
+ * WORKQ_RING 出队不拿锁，几个 worker 同时更新会丢掉几次，无所谓
+ */
+static void workq_latency(workq_t* wq, long stamp)
+{
+    long latency = __atomic_load_n(&wq->latency, __ATOMIC_RELAXED);
+    latency += (workq_now() - stamp - latency) / 8;
+    __atomic_store_n(&wq->latency, latency, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief 入队的时间戳：只有策略要看延迟的时候才读时钟
+ *
+ */
+static long workq_stamp(workq_t* wq)
+{
+    return wq->policy.grow_latency > 0 ? workq_now() : 0;
+}
+
+/**
+ * @brief 持有 mutex 时调用：来了 n 个新的工作，唤醒 min(n, idle) 个空闲的线程，剩下的问策略要不要（没到上限的话）再创建
+ *
+ * idle、counter 只在 mutex 里改，但是 WORKQ_RING 的 workq_add 会不拿锁先看一眼，所以用原子操作
+ */
+static int workq_kick(workq_t* wq, int n)
+{
+    int status;
+    pthread_t id;
+    workq_load_t load;
+
+    int idle = wq->idle - wq->signaled; // 叫过了还没醒的不算
+    int wake = n < idle ? n : idle;
+    if (wake > 1 && wake == idle) {
+        status = pthread_cond_broadcast(&wq->cv); // 全叫醒
+        if (status != 0) {
+            return status;
+        }
+    } else {
+        for (int i = 0; i < wake; i++) {
+            status = pthread_cond_signal(&wq->cv);
+            if (status != 0) {
+                return status;
+            }
+        }
+    }
+    wq->signaled += wake;
+
+    if (wq->counter >= wq->parallelism) {
+        if (n > wake && wq->policy.hysteresis > 0) {
+            wq->grown = workq_now(); // 到上限了加不了，但也说明 worker 不够用
+        }
+        return 0;
+    }
+    workq_load(wq, &load);
+    load.pending = n - wake;
+
+    n = wq->policy.grow(&wq->policy, &load);
+    if (n > 0) {
+        wq->grown = workq_now();
+    }
+    for (; n > 0 && wq->counter < wq->parallelism; n--) {
+        DPRINTF(("creating new worker\n"));
+        status = pthread_create(&id, &wq->attr, workq_server, (void*)wq);
+        if (status != 0) {
+            return status;
+        }
+        __atomic_add_fetch(&wq->counter, 1, __ATOMIC_SEQ_CST);
+    }
+    return 0;
+}
+
+/**
+ * @brief 不拿 mutex 的时候，看看有没有人需要唤醒 / 创建：和 workq_server 里 idle++ 之后的 fence 配对
+ *
+ */
+static int workq_wakeup(workq_t* wq, int n)
+{
+    int status;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&wq->idle, __ATOMIC_SEQ_CST) == 0
+        && __atomic_load_n(&wq->counter, __ATOMIC_SEQ_CST) >= wq->parallelism) {
+        return 0; // 所有 worker 都在忙，它们忙完会自己来取
+    }
+
+    status = pthread_mutex_lock(&wq->mutex);
+    if (status != 0) {
+        return status;
+    }
+    status = workq_kick(wq, n);
+    pthread_mutex_unlock(&wq->mutex);
+    return status;
+}
+
+/**
+ * WORKQ_RING：放进环里不用锁，放好之后再看 idle / counter，需要唤醒或者创建线程的时候才拿 mutex。
+ *
+ * worker 睡之前是 先 idle++，再看一眼环；我们是 先放进环，再看 idle。中间都有 SEQ_CST 的 fence，
+ * 所以要么 worker 看到了我们放的元素，要么我们看到它 idle 了、去 mutex 里唤醒它（它在 cond_wait 之前一直拿着 mutex）
+ */
+static int workq_ring_push_wait(workq_t* wq, void* element, long stamp)
+{
+    int status;
+
+    while (workq_ring_push(&wq->ring, element, stamp) != 0) {
+        /* engine 里放的：自己就是腾地方的 worker，等下去可能所有 worker 都在这里等，谁也不取 */
+        if (workq_current == wq) {
+            return EAGAIN;
+        }
+        /* 满了：worker 可能都在睡（或者还没创建），先把它们叫起来，然后让出 cpu 等它们腾地方 */
+        status = pthread_mutex_lock(&wq->mutex);
+        if (status != 0) {
+            return status;
+        }
+        status = workq_kick(wq, 1);
+        pthread_mutex_unlock(&wq->mutex);
+        if (status != 0) {
+            return status;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
 int workq_add(workq_t* wq, void* element)
 {
 
@@ -114,17 +811,35 @@ int workq_add(workq_t* wq, void* element)
         return EINVAL;
     }
 
-    workq_ele_t* item = (workq_ele_t*)malloc(sizeof(workq_ele_t));
-    if (item == NULL) {
-        return ENOMEM;
+    if (wq->backend == WORKQ_RING) {
+        status = workq_ring_push_wait(wq, element, workq_stamp(wq));
+        if (status != 0) {
+            return status;
+        }
+        return workq_wakeup(wq, 1);
     }
-    item->data = element;
-    item->next = NULL;
+
+    /* WORKQ_STEAL：engine 里加的，放进自己的队列 */
+    if (workq_self != NULL && workq_self->wq == wq) {
+        status = workq_deque_push(&workq_self->deque, element);
+        if (status != 0) {
+            return status;
+        }
+        return workq_wakeup(wq, 1);
+    }
+
     status = pthread_mutex_lock(&wq->mutex);
     if (status != 0) {
-        free(item);
         return status;
     }
+    workq_ele_t* item = workq_ele_alloc(wq);
+    if (item == NULL) {
+        pthread_mutex_unlock(&wq->mutex);
+        return ENOMEM;
+    }
+    item->data = element;
+    item->next = NULL;
+    item->stamp = workq_stamp(wq);
 
     /* 尾插 */
     if (wq->first == NULL) {
@@ -134,87 +849,260 @@ int workq_add(workq_t* wq, void* element)
     }
     wq->last = item;
 
-    /* 如果有空闲的线程，那么 */
-    pthread_t id;
-    if (wq->idle > 0) {
-        status = pthread_cond_signal(&wq->cv);
-        if (status != 0) {
-            pthread_mutex_unlock(&wq->mutex);
-            return status;
+    /* 如果有空闲的线程，那么唤醒它，否则创建一个 */
+    status = workq_kick(wq, 1);
+    pthread_mutex_unlock(&wq->mutex);
+    return status;
+}
+
+/**
+ * @brief 一次放 n 个：一次上锁，从 freelist 里拿 n 个元素接到链表尾巴上，唤醒 / 创建的线程数按 n 算
+ *
+ * WORKQ_RING、WORKQ_STEAL（engine 里）本来就不拿锁放，放完 n 个再统一唤醒一次
+ */
+int workq_add_batch(workq_t* wq, void** elements, int n)
+{
+    int status;
+
+    if (wq->valid != WORKQ_VALID || n < 0) {
+        return EINVAL;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    if (wq->backend == WORKQ_RING) {
+        long stamp = workq_stamp(wq);
+        for (int i = 0; i < n; i++) {
+            status = workq_ring_push_wait(wq, elements[i], stamp);
+            if (status != 0) {
+                return status;
+            }
         }
-    } else if (wq->counter < wq->parallelism) {
-        printf("creating new worker\n");
-        status = pthread_create(&id, &wq->attr, workq_server, (void*)wq);
-        if (status != 0) {
+        return workq_wakeup(wq, n);
+    }
+
+    if (workq_self != NULL && workq_self->wq == wq) {
+        for (int i = 0; i < n; i++) {
+            status = workq_deque_push(&workq_self->deque, elements[i]);
+            if (status != 0) {
+                return status;
+            }
+        }
+        return workq_wakeup(wq, n);
+    }
+
+    status = pthread_mutex_lock(&wq->mutex);
+    if (status != 0) {
+        return status;
+    }
+
+    long stamp = workq_stamp(wq);
+    workq_ele_t *first = NULL, *last = NULL;
+    for (int i = 0; i < n; i++) {
+        workq_ele_t* item = workq_ele_alloc(wq);
+        if (item == NULL) {
+            while (first != NULL) {
+                item = first->next;
+                workq_ele_free(wq, first);
+                first = item;
+            }
             pthread_mutex_unlock(&wq->mutex);
-            return status;
+            return ENOMEM;
+        }
+        item->data = elements[i];
+        item->next = NULL;
+        item->stamp = stamp;
+        if (first == NULL) {
+            first = item;
+        } else {
+            last->next = item;
         }
-        wq->counter++;
+        last = item;
+    }
+
+    if (wq->first == NULL) {
+        wq->first = first;
+    } else {
+        wq->last->next = first;
     }
+    wq->last = last;
+
+    status = workq_kick(wq, n);
     pthread_mutex_unlock(&wq->mutex);
+    return status;
+}
+
+/**
+ * @brief 不用 mutex 就能取的：WORKQ_RING 的环，WORKQ_STEAL 自己的队列、别人的队列
+ *
+ */
+static int workq_get_nolock(workq_t* wq, void** data)
+{
+    if (wq->backend == WORKQ_RING) {
+        long stamp;
+        if (workq_ring_pop(&wq->ring, data, &stamp) != 0) {
+            return 0;
+        }
+        if (wq->policy.grow_latency > 0) {
+            workq_latency(wq, stamp);
+        }
+        return 1;
+    }
+    if (wq->backend == WORKQ_STEAL) {
+        return workq_deque_take(&workq_self->deque, data) || workq_steal(wq, workq_self, data);
+    }
     return 0;
 }
 
+/**
+ * @brief 持有 mutex 时调用：取一个元素，没有返回 0
+ *
+ */
+static int workq_get(workq_t* wq, void** data)
+{
+    workq_ele_t* we = wq->first;
+    if (we == NULL) {
+        return workq_get_nolock(wq, data);
+    }
+    wq->first = we->next;
+    if (wq->last == we) {
+        wq->last = NULL;
+    }
+    *data = we->data;
+    if (wq->policy.grow_latency > 0) {
+        workq_latency(wq, we->stamp);
+    }
+    workq_ele_free(wq, we);
+    return 1;
+}
+
+/**
+ * @brief 持有 mutex 时调用：worker 退出前让出自己的位置。队列是空的（取不到东西才会退出），留给下一个 worker 接着用
+ *
+ */
+static void workq_release(void)
+{
+    if (workq_self != NULL) {
+        workq_self->busy = 0;
+        workq_self = NULL;
+    }
+}
+
 static void* workq_server(void* arg)
 {
     int status;
+    void* data;
 
     workq_t* wq = (workq_t*)arg;
 
-    printf("a worker is starting\n");
+    DPRINTF(("a worker is starting\n"));
+    workq_current = wq;
 
     status = pthread_mutex_lock(&wq->mutex);
     if (status != 0) {
         return NULL;
     }
 
+    if (wq->backend == WORKQ_STEAL) {
+        /* 占一个空位置：counter <= parallelism，一定有 */
+        workq_self = wq->workers;
+        while (workq_self->busy) {
+            workq_self++;
+        }
+        workq_self->busy = 1;
+    }
+
     while (1) {
         int timedout = 0;
-        printf("worker waiting for worker\n");
+        int got;
+        DPRINTF(("worker waiting for work\n"));
 
         struct timespec timeout;
         clock_gettime(CLOCK_REALTIME, &timeout);
-        timeout.tv_sec += 2;
+        timeout.tv_sec += wq->policy.idle_timeout / 1000;
+        timeout.tv_nsec += wq->policy.idle_timeout % 1000 * 1000000;
+        if (timeout.tv_nsec >= 1000000000) {
+            timeout.tv_sec++;
+            timeout.tv_nsec -= 1000000000;
+        }
 
-        while (wq->first == NULL && !wq->quit) {
-            status = pthread_cond_timedwait(&wq->cv, &wq->mutex, &timeout);
+        /* 先算自己空闲，再看队列：和 workq_wakeup 里的 fence 配对 */
+        __atomic_add_fetch(&wq->idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (!(got = workq_get(wq, &data)) && !wq->quit) {
+            if (wq->persistent) { // 常驻的 worker 不会因为闲着退出
+                status = pthread_cond_wait(&wq->cv, &wq->mutex);
+            } else {
+                status = pthread_cond_timedwait(&wq->cv, &wq->mutex, &timeout);
+            }
+            if (status == 0 && wq->signaled > 0) {
+                wq->signaled--;
+            }
             if (status == ETIMEDOUT) {
-                printf("worker wait timed out\n");
-                timedout = 1;
+                DPRINTF(("worker wait timed out\n"));
+                got = workq_get(wq, &data); // 最后再看一眼
+                if (!got) {
+                    workq_load_t load;
+                    workq_load(wq, &load);
+                    timedout = wq->policy.shrink(&wq->policy, &load); // 0：策略要留着它，接着等
+                }
+                if (timedout) {
+                    /* 要退出：还算在 idle 里的时候先把 counter 减掉。这样 workq_wakeup 看到 idle == 0 的时候
+                     * 一定也看到 counter 少了一个，会去 mutex 里创建新的 worker，不会把刚放进来的元素晾在那里 */
+                    workq_release();
+                    __atomic_sub_fetch(&wq->counter, 1, __ATOMIC_SEQ_CST);
+                }
                 break;
             } else if (status != 0) {
                 printf("worker wait failed, %d (%s)", status, strerror(status));
-                wq->counter--;
+                workq_release();
+                __atomic_sub_fetch(&wq->idle, 1, __ATOMIC_SEQ_CST);
+                if (wq->signaled > wq->idle) {
+                    wq->signaled = wq->idle;
+                }
+                __atomic_sub_fetch(&wq->counter, 1, __ATOMIC_SEQ_CST);
                 pthread_mutex_unlock(&wq->mutex);
                 return NULL;
             }
         }
-        printf("work queue: 0x%p, quit: %d\n", wq->first, wq->quit);
-
-        workq_ele_t* we = wq->first;
+        __atomic_sub_fetch(&wq->idle, 1, __ATOMIC_SEQ_CST);
+        if (wq->signaled > wq->idle) {
+            wq->signaled = wq->idle; // 没等就取到了的话，叫它的那一下落到了别人身上
+        }
+        DPRINTF(("work queue: %d, quit: %d\n", got, wq->quit));
 
-        if (we != NULL) {
-            wq->first = we->next;
-            if (wq->last == we) {
-                wq->last = NULL;
-            }
+        if (got) {
             status = pthread_mutex_unlock(&wq->mutex);
             if (status != 0) {
                 return NULL;
             }
-            printf("worker calling engine\n");
-            wq->engine(we->data);
-            free(we);
+            DPRINTF(("worker calling engine\n"));
+            wq->engine(data);
+            /* WORKQ_RING、WORKQ_STEAL 取元素不用锁：一直取到空了，再回到 mutex 里准备睡 */
+            while (workq_get_nolock(wq, &data)) {
+                wq->engine(data);
+            }
             status = pthread_mutex_lock(&wq->mutex);
             if (status != 0) {
                 return NULL;
             }
+            continue;
+        }
+
+        if (timedout) { // counter 上面已经减过了
+            DPRINTF(("engine terminating due to timeout.\n"));
+            if (wq->quit && wq->counter == 0) {
+                pthread_cond_broadcast(&wq->cv); // destroy 在等
+            }
+            break;
         }
 
         /* 只有： quit 的时候才会进入到这里 */
-        if (wq->first == NULL && wq->quit) {
-            printf("worker shutting down\n");
-            wq->counter--;
+        if (wq->quit) {
+            DPRINTF(("worker shutting down\n"));
+            workq_release();
+            __atomic_sub_fetch(&wq->counter, 1, __ATOMIC_SEQ_CST);
             if (wq->counter == 0) {
                 pthread_cond_broadcast(&wq->cv);
                 // 这个 broadcast 对应于上面 destroy
@@ -222,15 +1110,9 @@ static void* workq_server(void* arg)
             pthread_mutex_unlock(&wq->mutex);
             return NULL;
         }
-
-        if (wq->first == NULL && timedout) {
-            printf("engine terminating due to timeoue.\n");
-            wq->counter--;
-            break;
-        }
     }
 
     pthread_mutex_unlock(&wq->mutex);
-    printf("wroker exiting\n");
+    DPRINTF(("worker exiting\n"));
     return NULL;
-}
\ No newline at end of file
+}
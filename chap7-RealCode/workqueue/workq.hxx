@@ -2,34 +2,182 @@
 #define __WORKQ_HXX__
 
 #include <pthread.h>
+#include <sched.h>
+
+/**
+ * 队列的实现，workq_attr_setbackend 的时候选定：
+ *
+ * WORKQ_LIST : 默认，和原来一样：每个元素 malloc 一个 workq_ele_t，挂在 first / last 链表上，都在 mutex 里做
+ * WORKQ_RING : 有界的 MPMC 环形队列（Vyukov）：每个格子带一个序号，生产者、消费者各自 CAS 自己的下标，
+ *              平时不碰 mutex，也不分配内存；只有要唤醒 / 创建 worker，或者 worker 要睡的时候才去拿 mutex。
+ *              满了的时候 workq_add 让出 cpu 等 worker 腾地方；但在 engine 里（worker 自己）满了直接返回 EAGAIN，
+ *              不然所有 worker 都可能卡在 workq_add 里，谁也不取。engine 里还会大量 workq_add 的，容量要给够，或者用 WORKQ_STEAL
+ * WORKQ_STEAL: 每个 worker 一个 Chase-Lev 双端队列。worker 自己（engine 里）workq_add 的元素放进自己的队列底部，
+ *              自己也从底部取，不用锁；自己的取完了，就从随机的一个别人的队列顶部偷。
+ *              不是 worker 的线程 workq_add 的元素放在 first / last 链表上（注入队列），还是在 mutex 里做。
+ *              适合 engine 里还会继续 workq_add 的递归展开（比如遍历目录树）
+ */
+#define WORKQ_LIST 0
+#define WORKQ_RING 1
+#define WORKQ_STEAL 2
+
+#define WORKQ_RING_SIZE 1024 // WORKQ_RING 默认的格子数
+#define WORKQ_DEQUE_SIZE 64 // WORKQ_STEAL 每个双端队列一开始的大小，满了翻倍
 
 typedef struct workq_ele_tag {
     struct workq_ele_tag* next;
     void* data;
+    long stamp; // 入队的时间，策略要看延迟的时候才有
 } workq_ele_t;
 
+/**
+ * 链表的元素不再一个一个 malloc / free：一次 malloc 一块 WORKQ_SLAB 个，串在 freelist 上，
+ * 出队的时候还回 freelist。都在 mutex 里做，destroy 的时候才整块释放
+ */
+#define WORKQ_SLAB 64
+
+typedef struct workq_slab_tag {
+    struct workq_slab_tag* next;
+    workq_ele_t ele[WORKQ_SLAB];
+} workq_slab_t;
+
+typedef struct workq_cell_tag {
+    unsigned long sequence; // == 下标：空的，可以放；== 下标 + 1：放好了，可以取
+    void* data;
+    long stamp;
+} workq_cell_t;
+
+typedef struct workq_ring_tag {
+    workq_cell_t* cells;
+    unsigned long mask; // 格子数 - 1，格子数是 2 的幂
+    alignas(64) unsigned long enqueue; // 生产者、消费者的下标各占一个 cache line
+    alignas(64) unsigned long dequeue;
+} workq_ring_t;
+
+typedef struct workq_array_tag {
+    long size; // 2 的幂
+    void** buf;
+    struct workq_array_tag* prev; // 扩容前的数组：偷的人可能还在读，destroy 的时候才释放
+} workq_array_t;
+
+typedef struct workq_deque_tag {
+    alignas(64) long top; // 偷的人 CAS 这一头
+    alignas(64) long bottom; // 只有主人改
+    workq_array_t* array;
+} workq_deque_t;
+
+struct workq_tag;
+
+typedef struct workq_worker_tag {
+    workq_deque_t deque;
+    struct workq_tag* wq;
+    int busy; // 这个位置有没有 worker 在用，在 mutex 里改
+    unsigned int seed; // 挑偷谁
+} workq_worker_t;
+
+/**
+ * worker 数量的策略：workq_add 有没人管的新元素（空闲的 worker 都叫醒了还不够）的时候问 grow 要加几个 worker，
+ * worker 闲够 idle_timeout 的时候问 shrink 它能不能退出。grow / shrink 可以换成自己的，参数放在这个结构里
+ */
+typedef struct workq_load_tag {
+    int workers; // 当前 worker 数
+    int idle; // 空闲的（不算刚叫醒的）
+    int pending; // 这次新来的、没有空闲 worker 管的元素数
+    long depth; // 排队的元素数（近似）
+    long latency; // 入队到出队的时间，EWMA，ns；grow_latency 是 0 的时候不量
+    long since_grow; // 离上次要增长（创建了 worker，或者到上限了还不够用）多久了，ns
+} workq_load_t;
+
+typedef struct workq_policy_tag {
+    int min_workers; // 少于它就先补够；闲着也不会退到它以下
+    int max_workers; // 0：就用 workq_init 的 threads
+    long idle_timeout; // ms，闲这么久问一次 shrink
+    long hysteresis; // ms，要增长之后这么久之内不收缩
+    long grow_depth; // 平均每个 worker 排队超过这么多就加
+    long grow_latency; // ns，入队到出队超过这么久就加；0：不看
+    int (*grow)(const struct workq_policy_tag* policy, const workq_load_t* load); // 返回要加几个
+    int (*shrink)(const struct workq_policy_tag* policy, const workq_load_t* load); // 返回非 0：这个闲着的 worker 退出
+} workq_policy_t;
+
+/**
+ * 默认 worker 是 workq_add 的时候按需创建的，闲了 2 秒就退出。
+ * persistent：workq_init_attr 的时候就把 parallelism 个 worker 都创建好，一直留到 workq_destroy；
+ * 如果还设置了 cpus，第 i 个 worker 绑到 cpus 里的第 i 个 cpu 上（worker 比 cpu 多就绕回来）。
+ * 设置了 cpus 但不是 persistent 的话，workq_init_attr 返回 EINVAL
+ */
+typedef struct workq_attr_tag {
+    int backend;
+    unsigned long capacity; // WORKQ_RING 的格子数，会向上取成 2 的幂
+    int persistent;
+    cpu_set_t cpus; // 空的：不绑
+    workq_policy_t policy;
+} workq_attr_t;
+
 typedef struct workq_tag {
     pthread_mutex_t mutex;
     pthread_cond_t cv;
     pthread_attr_t attr; // 创建 detached threads
     workq_ele_t *first, *last;
+    workq_ele_t* free; // 空闲的元素
+    workq_slab_t* slabs; // 所有分配过的块
+    long outstanding; // 在队列里的元素个数
+    long cached; // freelist 里的元素个数
     int valid;
     int quit;
     int parallelism; // 最大线程数量
     int counter; // 当前线程数量
     int idle; // 空闲的线程的数量
+    int signaled; // idle 里已经 signal 过、还没醒过来的
     void (*engine)(void* arg);
+    int backend;
+    int persistent; // worker 不会超时退出
+    workq_policy_t policy;
+    long latency; // 入队到出队的时间，EWMA，ns
+    long grown; // 上次要增长的时间，ns
+    workq_ring_t ring;
+    workq_worker_t* workers; // WORKQ_STEAL：parallelism 个位置，worker 启动的时候占一个
 } workq_t;
 
 #define WORKQ_VALID 0xdec1992
 
+extern int workq_attr_init(workq_attr_t* attr);
+
+extern int workq_attr_setbackend(workq_attr_t* attr, int backend);
+
+extern int workq_attr_setcapacity(workq_attr_t* attr, unsigned long capacity);
+
+extern int workq_policy_init(workq_policy_t* policy);
+
+/* 默认的 grow / shrink，自己的策略可以在它们的基础上改 */
+extern int workq_policy_grow(const workq_policy_t* policy, const workq_load_t* load);
+
+extern int workq_policy_shrink(const workq_policy_t* policy, const workq_load_t* load);
+
+extern int workq_attr_setpolicy(workq_attr_t* attr, const workq_policy_t* policy);
+
+extern int workq_attr_setpersistent(workq_attr_t* attr, int persistent);
+
+extern int workq_attr_setaffinity(workq_attr_t* attr, const cpu_set_t* cpus);
+
 extern int workq_init(
     workq_t* wq,
     int threads,
     void (*engin)(void*));
 
+extern int workq_init_attr(
+    workq_t* wq,
+    int threads,
+    void (*engin)(void*),
+    const workq_attr_t* attr);
+
 extern int workq_destroy(workq_t* wq);
 
 extern int workq_add(workq_t* wq, void* data);
 
+/* 一次放 n 个，只上一次锁。链表出错的时候一个都不放；WORKQ_RING、WORKQ_STEAL（engine 里）出错（包括 EAGAIN）的时候前面的已经放进去了 */
+extern int workq_add_batch(workq_t* wq, void** data, int n);
+
+/* 链表元素：outstanding 是还在队列里的，cached 是在 freelist 里等着复用的。都可以是 NULL */
+extern int workq_nodes(workq_t* wq, long* outstanding, long* cached);
+
 #endif
@@ -0,0 +1,356 @@
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <vector>
+
+#include "errors.hxx"
+#include "workq.hxx"
+
+/**
+ * 几种队列比一比：
+ *   flat：producers 个线程一共往队列里放 ITEMS 个元素，engine 只是数一下，看每秒能处理多少个；
+ *   batch：和 flat 一样，只是每次 workq_add_batch 放 BATCH 个；
+ *   tree：只放一个根，engine 里每个元素再 workq_add 两个孩子，一共 TREE_DEPTH 层（像遍历目录树）
+ * nodes 是 batch 跑完以后链表元素的 还在队列里的 / freelist 里缓存着的 个数（WORKQ_RING 不用链表）：
+ * 前者应该是 0，后者是队列最长的时候的长度（按 WORKQ_SLAB 取整），和放了多少个无关。
+ * steady 一次只放一个、处理完再放下一个，放 STEADY_ITEMS 个以后 freelist 里应该还是只有一块
+ * 每种队列再分别用 按需创建的 worker（lazy）和 一开始就创建好、绑在 cpu 上的 worker（pinned）跑一遍
+ *
+ * 跑之前先做一遍回归检查（strand）：只有 1 个 worker、idle_timeout 1 ms，隔一会儿放一个元素，
+ * 让 worker 正好在超时退出的时候来新元素；1 秒内没处理完就是元素被晾在队列里没人管了
+ *
+ * sawtooth：锯齿形负载，每个波峰一下放 SAW_ITEMS 个慢元素（每个 SAW_WORK us），然后歇 SAW_QUIET ms，
+ * 比 idle_timeout（SAW_IDLE ms）长、比 hysteresis（SAW_HYSTERESIS ms）短；打出每个波峰、波谷时的 worker 数。
+ * 不设 hysteresis 的时候每个波谷 worker 都退光，下一个波峰再重新创建；设了以后波谷里还留着
+ *
+ * usage: workq [workers] [producers]
+ */
+
+#define ITEMS 1000000
+#define BATCH 256
+#define TREE_DEPTH 20 // 2^20 - 1 个元素
+#define STRAND_ROUNDS 1000
+#define STEADY_ITEMS 100000
+#define SAW_PHASES 5
+#define SAW_ITEMS 200
+#define SAW_WORK 200 // us
+#define SAW_IDLE 10 // ms
+#define SAW_QUIET 50 // ms
+#define SAW_HYSTERESIS 500 // ms
+
+typedef struct producer_tag {
+    pthread_t thread_id;
+    workq_t* wq;
+    long items;
+    int batch;
+} producer_t;
+
+static const char* backend_names[] = { "list", "ring", "steal" };
+static long done;
+static int pinned;
+static long outstanding, cached;
+static workq_t* tree_wq;
+
+static void engine_routine(void* arg)
+{
+    (void)arg;
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+}
+
+static void saw_routine(void* arg)
+{
+    (void)arg;
+    usleep(SAW_WORK);
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+}
+
+/* 元素就是它所在的层数 */
+static void tree_routine(void* arg)
+{
+    int status;
+    long depth = (long)arg;
+
+    if (depth + 1 < TREE_DEPTH) {
+        status = workq_add(tree_wq, (void*)(depth + 1));
+        HANDLE_STATUS("add child");
+        status = workq_add(tree_wq, (void*)(depth + 1));
+        HANDLE_STATUS("add child");
+    }
+    __atomic_add_fetch(&done, 1, __ATOMIC_RELAXED);
+}
+
+static void* producer_routine(void* arg)
+{
+    int status;
+    producer_t* self = (producer_t*)arg;
+
+    void* items[BATCH];
+
+    if (self->batch > 1) {
+        for (long i = 0; i < self->items; i += self->batch) {
+            int n = self->items - i < self->batch ? self->items - i : self->batch;
+            for (int j = 0; j < n; j++) {
+                items[j] = (void*)(i + j);
+            }
+            status = workq_add_batch(self->wq, items, n);
+            HANDLE_STATUS("add batch");
+        }
+        return NULL;
+    }
+
+    for (long i = 0; i < self->items; i++) {
+        status = workq_add(self->wq, (void*)i);
+        HANDLE_STATUS("add item");
+    }
+    return NULL;
+}
+
+static void set_attr(workq_attr_t* attr, int backend)
+{
+    int status;
+    cpu_set_t cpus;
+
+    workq_attr_init(attr);
+    status = workq_attr_setbackend(attr, backend);
+    HANDLE_STATUS("set backend");
+    if (pinned) {
+        status = sched_getaffinity(0, sizeof(cpus), &cpus);
+        if (status != 0) {
+            errno_abort("get affinity");
+        }
+        workq_attr_setpersistent(attr, 1);
+        workq_attr_setaffinity(attr, &cpus);
+    }
+}
+
+static double run(int backend, int workers, int producers, int batch)
+{
+    int status;
+    workq_t wq;
+    workq_attr_t attr;
+    std::vector<producer_t> threads(producers);
+    struct timespec start, end;
+
+    set_attr(&attr, backend);
+    status = workq_init_attr(&wq, workers, engine_routine, &attr);
+    HANDLE_STATUS("init workq");
+
+    done = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < producers; i++) {
+        threads[i].wq = &wq;
+        threads[i].items = ITEMS / producers;
+        threads[i].batch = batch;
+        status = pthread_create(&threads[i].thread_id, NULL, producer_routine, &threads[i]);
+        HANDLE_STATUS("create producer");
+    }
+    for (int i = 0; i < producers; i++) {
+        status = pthread_join(threads[i].thread_id, NULL);
+        HANDLE_STATUS("join producer");
+    }
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) < (ITEMS / producers) * producers) {
+        sched_yield();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    status = workq_nodes(&wq, &outstanding, &cached);
+    HANDLE_STATUS("get nodes");
+    status = workq_destroy(&wq);
+    HANDLE_STATUS("destroy workq");
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return done / seconds;
+}
+
+static double run_tree(int backend, int workers)
+{
+    int status;
+    workq_t wq;
+    workq_attr_t attr;
+    struct timespec start, end;
+
+    set_attr(&attr, backend);
+    status = workq_attr_setcapacity(&attr, 1L << TREE_DEPTH); // 环满了 engine 里的 workq_add 返回 EAGAIN
+    HANDLE_STATUS("set capacity");
+    status = workq_init_attr(&wq, workers, tree_routine, &attr);
+    HANDLE_STATUS("init workq");
+    tree_wq = &wq;
+
+    done = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status = workq_add(&wq, (void*)0L);
+    HANDLE_STATUS("add root");
+    while (__atomic_load_n(&done, __ATOMIC_RELAXED) < (1L << TREE_DEPTH) - 1) {
+        sched_yield();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    status = workq_destroy(&wq);
+    HANDLE_STATUS("destroy workq");
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return done / seconds;
+}
+
+static int run_strand(int backend)
+{
+    int status;
+    workq_t wq;
+    workq_attr_t attr;
+    workq_policy_t policy;
+    unsigned int seed = 1;
+    struct timespec start, now;
+
+    workq_attr_init(&attr);
+    status = workq_attr_setbackend(&attr, backend);
+    HANDLE_STATUS("set backend");
+    workq_policy_init(&policy);
+    policy.idle_timeout = 1;
+    status = workq_attr_setpolicy(&attr, &policy);
+    HANDLE_STATUS("set policy");
+    status = workq_init_attr(&wq, 1, engine_routine, &attr);
+    HANDLE_STATUS("init workq");
+
+    done = 0;
+    for (long i = 0; i < STRAND_ROUNDS; i++) {
+        status = workq_add(&wq, (void*)i);
+        HANDLE_STATUS("add item");
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (__atomic_load_n(&done, __ATOMIC_RELAXED) <= i) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (now.tv_sec - start.tv_sec > 1) {
+                printf("STRANDED item %ld on %s (done=%ld)\n", i, backend_names[backend], done);
+                return 1;
+            }
+            sched_yield();
+        }
+        usleep(rand_r(&seed) % 2000); // 0 ~ 2 ms，和 idle_timeout 差不多
+    }
+
+    status = workq_destroy(&wq);
+    HANDLE_STATUS("destroy workq");
+    return 0;
+}
+
+static void run_steady(void)
+{
+    int status;
+    workq_t wq;
+
+    status = workq_init(&wq, 1, engine_routine);
+    HANDLE_STATUS("init workq");
+
+    done = 0;
+    for (long i = 0; i < STEADY_ITEMS; i++) {
+        status = workq_add(&wq, (void*)i);
+        HANDLE_STATUS("add item");
+        while (__atomic_load_n(&done, __ATOMIC_RELAXED) <= i) {
+            sched_yield();
+        }
+    }
+
+    status = workq_nodes(&wq, &outstanding, &cached);
+    HANDLE_STATUS("get nodes");
+    printf("steady: %d items, nodes %ld/%ld\n", STEADY_ITEMS, outstanding, cached);
+
+    status = workq_destroy(&wq);
+    HANDLE_STATUS("destroy workq");
+}
+
+static int workers_of(workq_t* wq)
+{
+    int status, counter;
+
+    status = pthread_mutex_lock(&wq->mutex);
+    HANDLE_STATUS("lock mutex");
+    counter = wq->counter;
+    status = pthread_mutex_unlock(&wq->mutex);
+    HANDLE_STATUS("unlock mutex");
+    return counter;
+}
+
+static void run_sawtooth(int workers, long hysteresis)
+{
+    int status;
+    workq_t wq;
+    workq_attr_t attr;
+    workq_policy_t policy;
+    int peak[SAW_PHASES], trough[SAW_PHASES];
+
+    workq_attr_init(&attr);
+    workq_policy_init(&policy);
+    policy.idle_timeout = SAW_IDLE;
+    policy.hysteresis = hysteresis;
+    status = workq_attr_setpolicy(&attr, &policy);
+    HANDLE_STATUS("set policy");
+    status = workq_init_attr(&wq, workers, saw_routine, &attr);
+    HANDLE_STATUS("init workq");
+
+    done = 0;
+    for (int phase = 0; phase < SAW_PHASES; phase++) {
+        for (long i = 0; i < SAW_ITEMS; i++) {
+            status = workq_add(&wq, (void*)i);
+            HANDLE_STATUS("add item");
+        }
+        peak[phase] = workers_of(&wq);
+        while (__atomic_load_n(&done, __ATOMIC_RELAXED) < (phase + 1L) * SAW_ITEMS) {
+            sched_yield();
+        }
+        usleep(SAW_QUIET * 1000);
+        trough[phase] = workers_of(&wq);
+    }
+
+    status = workq_destroy(&wq);
+    HANDLE_STATUS("destroy workq");
+
+    printf("sawtooth hysteresis %4ld ms, workers peak/trough:", hysteresis);
+    for (int phase = 0; phase < SAW_PHASES; phase++) {
+        printf(" %d/%d", peak[phase], trough[phase]);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int workers = 4;
+    int producers = 4;
+
+    if (argc > 1) {
+        workers = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        producers = atoi(argv[2]);
+    }
+    if (workers <= 0 || producers <= 0) {
+        fprintf(stderr, "usage: %s [workers] [producers]\n", argv[0]);
+        return 1;
+    }
+
+    for (int backend : { WORKQ_LIST, WORKQ_RING, WORKQ_STEAL }) {
+        if (run_strand(backend) != 0) {
+            return 1;
+        }
+    }
+    printf("strand check: ok\n");
+    run_steady();
+    run_sawtooth(workers, 0);
+    run_sawtooth(workers, SAW_HYSTERESIS);
+
+    printf("%d items, %d workers, %d producers\n", ITEMS, workers, producers);
+    printf("%8s %8s %14s %14s %14s %14s\n", "backend", "workers", "flat items/s", "batch items/s", "tree items/s", "nodes");
+    for (int backend : { WORKQ_LIST, WORKQ_RING, WORKQ_STEAL }) {
+        for (pinned = 0; pinned < 2; pinned++) {
+            double flat = run(backend, workers, producers, 1);
+            double batch = run(backend, workers, producers, BATCH);
+            long nodes[2] = { outstanding, cached };
+            double tree = run_tree(backend, workers);
+            printf("%8s %8s %14.0f %14.0f %14.0f %7ld/%-6ld\n",
+                backend_names[backend], pinned ? "pinned" : "lazy", flat, batch, tree, nodes[0], nodes[1]);
+        }
+    }
+
+    return 0;
+}